@@ -16,30 +16,260 @@
  */
 
 // Compile with VS as:
-// cl /EHsc crc.cpp
+// cl /EHsc crc.cpp pcjr_crc.cpp pcjr_crc_clmul.cpp pcjr_file.cpp
+//    pcjr_batch.cpp pcjr_thread_pool.cpp pcjr_selftest.cpp pcjr_fixup.cpp
+//    pcjr_scan.cpp
+// or with g++ as:
+// g++ -std=c++11 -O2 -pthread -o crc crc.cpp pcjr_crc.cpp pcjr_crc_clmul.cpp
+//    pcjr_file.cpp pcjr_batch.cpp pcjr_thread_pool.cpp pcjr_selftest.cpp
+//    pcjr_fixup.cpp pcjr_scan.cpp
 
-#include <cassert>
 #include <cstdint>
-#include <fstream>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
 #include <iomanip>
 #include <iostream>
-#include <new>
-#include <utility> // for C++ 98, include <algorithm> instead
+#include <string>
+#include <vector>
 
-union Register
+#include "pcjr_batch.h"
+#include "pcjr_cart.h"
+#include "pcjr_crc.h"
+#include "pcjr_file.h"
+#include "pcjr_fixup.h"
+#include "pcjr_scan.h"
+#include "pcjr_selftest.h"
+
+static const char it_argument[]      = "/it";
+static const char jrc_argument[]     = "/jrc";
+static const char emu_argument[]     = "/emu";
+static const char table_argument[]   = "/table";
+static const char slice8_argument[]  = "/slice8";
+static const char clmul_argument[]   = "/clmul";
+static const char stream_argument[]  = "/stream";
+static const char batch_argument[]   = "/batch";
+static const char csv_argument[]     = "/csv";
+static const char json_argument[]    = "/json";
+static const char threads_argument[] = "/threads";
+static const char append_argument[]  = "/append";
+static const char selftest_argument[] = "/selftest";
+static const char fixup_argument[]   = "/fixup";
+static const char previous_argument[] = "/previous";
+static const char patch_argument[]   = "/patch";
+static const char scan_argument[]    = "/scan";
+static const char base_argument[]    = "/base";
+static const char force_argument[]   = "/force";
+
+// Filename used to read from stdin
+static const char stdin_filename[]  = "-";
+
+// Tell an absolute path apart from an option, options never contain a
+// second '/' and never name an existing file.
+static bool is_absolute_path(const char* argument)
+{
+  uint64_t size;
+  return strchr(argument + 1, '/') != 0 ||
+    pcjr::file_size(argument, size) ||
+    pcjr::is_directory(argument);
+}
+
+static void print_usage(const char* program)
+{
+  std::cerr << "Usage:\n"
+	    << program << " [/it] [/jrc] [/emu|/table|/slice8|/clmul] [/stream] "
+               "[/threads n]\n"
+	    << std::string(strlen(program), ' ') << " [/append length crc] "
+               "filename\n"
+	    << program << " /selftest\n"
+	    << program << " /fixup [/jrc] [/previous old_filename "
+               "[/patch offset:length[,...]]...]\n"
+	    << std::string(strlen(program), ' ') << " filename\n"
+	    << program << " /force crc offset [/it] [/jrc] "
+               "[/emu|/table|/slice8|/clmul] filename\n"
+	    << program << " /scan [/base address] [/csv|/json] [/threads n] "
+               "[/emu|/table|/slice8|/clmul]\n"
+	    << std::string(strlen(program), ' ') << " dump_filename\n"
+	    << program << " /batch [/csv|/json] [/threads n] "
+               "[/emu|/table|/slice8|/clmul] input...\n\n"
+	    << "/it  = optional argument to ignore last 2 bytes of file "
+               "(ignore tail).\n"
+	    << "/jrc = optional argument to ignore first 512 bytes of file "
+               "(JRC PCjr Cartridge File Format - .jrc).\n"
+	    << "/emu    = optional argument to use the reference emulation of "
+               "the BIOS assembly.\n"
+	    << "/table  = optional argument to use the 256 entry table "
+               "engine.\n"
+	    << "/slice8 = optional argument to use the slicing-by-8 engine.\n"
+	    << "/clmul  = optional argument to use the carry-less multiply "
+               "engine (falls back to /slice8 if the CPU lacks it).\n"
+	    << "Default is /clmul when supported, otherwise /slice8 (/table "
+               "for blocks under 16 bytes).\n"
+	    << "/stream = optional argument to read the file in blocks instead "
+               "of memory mapping it.\n"
+	    << "Use '-' as the filename to read from stdin (always "
+               "streamed).\n"
+	    << "/threads n = split the file across n threads (0 = one per "
+               "core, not with /stream\n"
+	    << "          or stdin). Also sets the number of worker threads "
+               "for /batch and /scan\n"
+	    << "          (default is one per core). At most 1024.\n"
+	    << "/append length crc = the first 'length' bytes to process were "
+               "already checksummed\n"
+	    << "          to 'crc' (hex) by an earlier run, only process what "
+               "was appended since.\n"
+	    << "/selftest = check every CRC engine against the emulation of "
+               "the BIOS assembly.\n\n"
+	    << "/batch  = verify every input against its trailing 2 byte CRC "
+               "and write a manifest\n"
+	    << "          to stdout. Inputs are files, directories (searched "
+               "recursively),\n"
+	    << "          wildcards (e.g. carts/*.jrc) or @list (one path per "
+               "line). .jrc\n"
+	    << "          headers are detected automatically.\n"
+	    << "/csv    = write the manifest as CSV (default).\n"
+	    << "/json   = write the manifest as JSON.\n\n"
+	    << "/fixup  = write the module length byte (after 0x55 0xAA) and "
+               "the trailing 2 byte\n"
+	    << "          CRC into a raw or .jrc image in place.\n"
+	    << "/previous old_filename = copy of the image before it was "
+               "patched, with a valid\n"
+	    << "          CRC. Only the patched bytes are read and the old CRC "
+               "is updated for them.\n"
+	    << "/patch offset:length = file offset (decimal or 0x hex) and "
+               "length of patched\n"
+	    << "          bytes, repeat or separate with ',' for more than "
+               "one.\n\n"
+	    << "/force crc offset = overwrite the 2 bytes at file offset "
+               "'offset' (decimal or\n"
+	    << "          0x hex) so the CRC computed with the same /it and "
+               "/jrc options is 'crc'\n"
+	    << "          (hex). Forcing a module to 0 without /it makes it "
+               "pass the BIOS check.\n\n"
+	    << "/scan   = find every ROM module in a memory or EPROM dump the "
+               "way the BIOS does\n"
+	    << "          (0x55 0xAA on a 2 KiB boundary), verify each one and "
+               "write a report in\n"
+	    << "          the /csv or /json format to stdout.\n"
+	    << "/base address = address (hex) of the start of the dump, e.g. "
+               "c0000, added to the\n"
+	    << "          module offsets in the report.\n";
+}
+
+// Compute and print the CRC of one file (or stdin)
+static int crc_file(const char*        filename,
+		    bool               ignore_last_2_characters,
+		    bool               jrc_file,
+		    bool               stream_input,
+		    bool               use_threads,
+		    unsigned int       threads,
+		    uint64_t           covered_length,
+		    uint16_t           covered_crc,
+		    pcjr::crc16_engine engine)
 {
- uint16_t x; // ax,bx,etc.
-  struct
+  // Window of the file the CRC covers
+  const uint64_t     skip        = ( !jrc_file ? 0 : pcjr::jrc_header_size );
+  const unsigned int ignore_tail = ( !ignore_last_2_characters ? 0 :
+				     pcjr::crc_size );
+
+  // Resume from the CRC of the bytes covered by an earlier run (if any)
+  uint16_t crc = covered_crc;
+
+  const bool read_stdin = ( strcmp(filename,stdin_filename) == 0 );
+
+  // Memory map the file unless asked not to. Fall back to streaming if it
+  // cannot be mapped (e.g. a named pipe or a file too big for the address
+  // space).
+  pcjr::mapped_file mapped_input;
+  if ( !stream_input && !read_stdin && mapped_input.open(filename) )
   {
-    uint8_t l; // al,bl,etc.
-    uint8_t h; // ah,bh, etc.
-  };
-};
+    const uint64_t file_size = mapped_input.size();
+
+    std::cout << "Input file '" << filename << "' is " << file_size
+	      << " bytes\n";
+
+    if ( !pcjr::crc16_window(mapped_input.data(),
+			     file_size,
+			     skip + covered_length,
+			     ignore_tail,
+			     use_threads,
+			     threads,
+			     engine,
+			     crc) )
+    {
+      std::cerr << "Input file is too small for the options specified\n";
+      return -1;
+    }
+
+    std::cout << "bytes to process: "
+	      << file_size - skip - covered_length - ignore_tail << "\n";
+  }
+  else
+  {
+    if ( use_threads )
+    {
+      // Only reached for files that could not be mapped, /stream and stdin
+      // with /threads are rejected up front
+      std::cerr << "'" << filename << "' cannot be memory mapped, it is "
+		"processed on one thread\n";
+    }
+
+    std::FILE* input_file = stdin;
+    if ( read_stdin )
+    {
+      pcjr::set_stdin_binary();
+    }
+    else
+    {
+      input_file = std::fopen(filename, "rb");
+    }
+
+    if ( input_file == 0 )
+    {
+      std::cerr << "Error opening input file: '" << filename << "'\n";
+      return -1;
+    }
+
+    uint64_t file_size = 0;
+    const bool stream_ok = pcjr::crc16_stream(input_file,
+					      skip + covered_length,
+					      ignore_tail,
+					      crc,
+					      file_size,
+					      engine);
+    const bool read_error = ( std::ferror(input_file) != 0 );
+
+    if ( !read_stdin )
+    {
+      std::fclose(input_file);
+    }
+
+    std::cout << "Read " << file_size << " bytes from '" << filename
+	      << "'\n";
+
+    if ( !stream_ok )
+    {
+      if ( read_error )
+      {
+	std::cerr << "Error reading input file: '" << filename << "'\n";
+      }
+      else
+      {
+	std::cerr << "Input file is too small for the options specified\n";
+      }
+      return -1;
+    }
+
+    std::cout << "bytes to process: "
+	      << file_size - skip - covered_length - ignore_tail << "\n";
+  }
 
-static const char it_argument[]   = "/it";
-static const char jrc_argument[]  = "/jrc";
+  // Output CRC to terminal
+  std::cout << "CRC: " << std::setw(4) << std::setfill('0')
+	    << std::hex << crc << '\n';
 
-static const unsigned short jrc_header_size = 512; // 0x200
+  return 0;
+}
 
 int main(int argc, char* argv[])
 {
@@ -47,55 +277,256 @@ int main(int argc, char* argv[])
   bool ignore_last_2_characters = false;
   bool jrc_file                 = false;
 
+  // Engine used for the CRC, the emulation of the BIOS assembly is kept as a
+  // selectable reference.
+  pcjr::crc16_engine engine     = pcjr::crc16_engine_auto;
+
+  // Read the file in blocks instead of memory mapping it
+  bool stream_input             = false;
+
+  // Verify many files and write a manifest
+  bool batch_mode               = false;
+  pcjr::batch_options batch_options;
+
+  // Split a single file across threads
+  bool use_threads              = false;
+
+  // Bytes already covered by an earlier run and their CRC
+  uint64_t covered_length       = 0;
+  uint16_t covered_crc          = pcjr::crc16_seed;
+
+  bool self_test                = false;
+
+  // Fill in the length byte and CRC of an image, optionally updating the CRC
+  // of an earlier version of it for just the patched bytes
+  bool fixup_mode               = false;
+  const char* previous_filename = 0;
+  std::vector<pcjr::byte_range> patches;
+
+  // Find and verify the modules in a dump
+  bool scan_mode                = false;
+  uint64_t scan_base            = 0;
+
+  // Overwrite 2 bytes of a file to give it a chosen CRC
+  bool force_mode               = false;
+  uint64_t force_offset         = 0;
+  uint16_t force_crc            = 0;
+
   bool invalid_argument         = false;
 
-  const unsigned short last_argument = argc - 1;
-  
+  // Everything that is not an option is a filename
+  std::vector<std::string> filenames;
+
   // Check arguments
   // argv[0] is this executive
-  // argv[argc-1] is the filename
-  for ( unsigned short i = 1 ; i < argc ; ++i )
+  for ( int i = 1 ; i < argc ; ++i )
   {
     // Make sure a valid flag is read.
     if ( strcmp(argv[i],it_argument) == 0 )
     {
-      // Mark invalid if we already found this argument
       ignore_last_2_characters = true;
     }
     else if ( strcmp(argv[i],jrc_argument ) == 0 )
     {
-      // Mark invalid if we already found this argument
       jrc_file = true;
     }
-    // Mark as invalid if this is not the last argument or if it is the last
-    // argument and does not start with a '/' (i.e. this is the filename as it
-    // should be).
-    else if ( ( i != last_argument ) ||
-	      ( ( i == last_argument ) && argv[i][0] == '/' ) )
+    else if ( strcmp(argv[i],emu_argument) == 0 )
+    {
+      engine = pcjr::crc16_engine_emulation;
+    }
+    else if ( strcmp(argv[i],table_argument) == 0 )
+    {
+      engine = pcjr::crc16_engine_table;
+    }
+    else if ( strcmp(argv[i],slice8_argument) == 0 )
+    {
+      engine = pcjr::crc16_engine_slice8;
+    }
+    else if ( strcmp(argv[i],clmul_argument) == 0 )
+    {
+      engine = pcjr::crc16_engine_clmul;
+    }
+    else if ( strcmp(argv[i],stream_argument) == 0 )
+    {
+      stream_input = true;
+    }
+    else if ( strcmp(argv[i],batch_argument) == 0 )
+    {
+      batch_mode = true;
+    }
+    else if ( strcmp(argv[i],csv_argument) == 0 )
+    {
+      batch_options.format = pcjr::manifest_csv;
+    }
+    else if ( strcmp(argv[i],json_argument) == 0 )
+    {
+      batch_options.format = pcjr::manifest_json;
+    }
+    else if ( strcmp(argv[i],threads_argument) == 0 )
+    {
+      // Takes the next argument as the thread count
+      char* end = 0;
+      unsigned long thread_count = 0;
+      if ( i + 1 < argc )
+      {
+	thread_count = strtoul(argv[i + 1], &end, 10);
+      }
+      if ( end == 0 || end == argv[i + 1] || *end != '\0' ||
+	   argv[i + 1][0] == '-' || thread_count > pcjr::max_threads )
+      {
+	std::cerr << "/threads takes 0 to " << pcjr::max_threads << '\n';
+	invalid_argument = true;
+      }
+      batch_options.threads = static_cast<unsigned int>(thread_count);
+      use_threads = true;
+      ++i;
+    }
+    else if ( strcmp(argv[i],append_argument) == 0 )
+    {
+      // Takes the next two arguments as the length (decimal) and CRC (hex)
+      char* length_end = 0;
+      char* crc_end    = 0;
+      unsigned long crc_value = 0;
+      if ( i + 2 < argc )
+      {
+	covered_length = strtoull(argv[i + 1], &length_end, 10);
+	crc_value      = strtoul(argv[i + 2], &crc_end, 16);
+      }
+      if ( length_end == 0 || length_end == argv[i + 1] ||
+	   *length_end != '\0' || crc_end == argv[i + 2] ||
+	   *crc_end != '\0' || crc_value > 0xFFFF )
+      {
+	invalid_argument = true;
+      }
+      covered_crc = static_cast<uint16_t>(crc_value);
+      i += 2;
+    }
+    else if ( strcmp(argv[i],selftest_argument) == 0 )
+    {
+      self_test = true;
+    }
+    else if ( strcmp(argv[i],fixup_argument) == 0 )
+    {
+      fixup_mode = true;
+    }
+    else if ( strcmp(argv[i],previous_argument) == 0 )
+    {
+      // Takes the next argument as the unpatched image
+      if ( i + 1 < argc )
+      {
+	previous_filename = argv[i + 1];
+      }
+      else
+      {
+	invalid_argument = true;
+      }
+      ++i;
+    }
+    else if ( strcmp(argv[i],scan_argument) == 0 )
+    {
+      scan_mode = true;
+    }
+    else if ( strcmp(argv[i],base_argument) == 0 )
+    {
+      // Takes the next argument as the address (hex) of the dump
+      char* end = 0;
+      if ( i + 1 < argc )
+      {
+	scan_base = strtoull(argv[i + 1], &end, 16);
+      }
+      if ( end == 0 || end == argv[i + 1] || *end != '\0' )
+      {
+	invalid_argument = true;
+      }
+      ++i;
+    }
+    else if ( strcmp(argv[i],force_argument) == 0 )
+    {
+      // Takes the next two arguments as the CRC (hex) and offset (decimal
+      // or 0x hex, a leading 0 is not octal)
+      char*       crc_end    = 0;
+      const char* offset_end = 0;
+      unsigned long crc_value = 0;
+      bool offset_ok = false;
+      if ( i + 2 < argc )
+      {
+	crc_value = strtoul(argv[i + 1], &crc_end, 16);
+	offset_ok = pcjr::parse_number(argv[i + 2], offset_end, force_offset);
+      }
+      if ( crc_end == 0 || crc_end == argv[i + 1] || *crc_end != '\0' ||
+	   crc_value > 0xFFFF || !offset_ok || *offset_end != '\0' )
+      {
+	invalid_argument = true;
+      }
+      force_mode = true;
+      force_crc  = static_cast<uint16_t>(crc_value);
+      i += 2;
+    }
+    else if ( strcmp(argv[i],patch_argument) == 0 )
+    {
+      // Takes the next argument as a list of patched ranges
+      if ( i + 1 >= argc || !pcjr::parse_ranges(argv[i + 1], patches) )
+      {
+	invalid_argument = true;
+      }
+      ++i;
+    }
+    // Anything else starting with a '/' is not a valid option, unless it is
+    // an absolute path (e.g. /home/user/cart.jrc)
+    else if ( argv[i][0] == '/' && !is_absolute_path(argv[i]) )
     {
       invalid_argument = true;
     }
+    else
+    {
+      filenames.push_back(argv[i]);
+    }
   }
 
-  // See if we have a filename properly specified. Leave at 0 pointer if not
-  const char* filename = 0;
+  // Patched ranges only mean something relative to an earlier image, and
+  // both only apply to /fixup
+  if ( ( !patches.empty() && previous_filename == 0 ) ||
+       ( previous_filename != 0 && !fixup_mode ) )
+  {
+    invalid_argument = true;
+  }
 
-  if ( argc >= 2 )
+  // /force rewrites the file itself, it does not mix with /fixup
+  if ( force_mode && fixup_mode )
   {
-    // filename must be the last argument (argc-1)
-    filename = argv[last_argument];
+    invalid_argument = true;
+  }
 
-    // Check to see if this was really an argument
-    if ( filename != 0 && filename[0] == '/' )
-    {
-      filename = 0;
-    }
+  // The self test, /fixup and /force always run on one thread
+  if ( use_threads && ( self_test || fixup_mode || force_mode ) )
+  {
+    std::cerr << "/threads cannot be used with /selftest, /fixup or "
+	      "/force\n";
+    invalid_argument = true;
+  }
+
+  // Streamed input is read and processed in order, it cannot be split
+  // across threads
+  const bool single_file_mode = ( !self_test && !batch_mode && !scan_mode &&
+				  !fixup_mode && !force_mode );
+  if ( single_file_mode && use_threads &&
+       ( stream_input ||
+	 ( filenames.size() == 1 && filenames[0] == stdin_filename ) ) )
+  {
+    std::cerr << "/threads cannot be used with /stream or stdin\n";
+    invalid_argument = true;
   }
 
+  // A single file is required unless in batch mode (or running the self
+  // test, which takes no files)
+  const bool invalid_filename = ( self_test ? !filenames.empty() :
+				  batch_mode ? filenames.empty() :
+				  filenames.size() != 1 );
+
   // Make sure argument are correct
-  if ( ( filename == 0 ) || invalid_argument )
+  if ( invalid_filename || invalid_argument )
   {
-    if ( filename == 0 )
+    if ( invalid_filename )
     {
       std::cerr << "No or invalid file specified.\n";
     }
@@ -104,111 +535,78 @@ int main(int argc, char* argv[])
       std::cerr << "Invalid argument\n";
     }
 
-    std::cerr << "Usage:\n"
-	      << argv[0] << " [/it] [/jrc] filename\n\n"
-	      << "/it  = optional argument to ignore last 2 bytes of file "
-                 "(ignore tail).\n"
-	      << "/jrc = optional argument to ignore first 512 bytes of file "
-                 "(JRC PCjr Cartridge File Format - .jrc).\n";
+    print_usage(argv[0]);
     return -1;
   }
 
-  // Attempt to open the file specified
-  std::ifstream input_file(filename, std::ios::in | std::ios::binary);
-
-  if ( !input_file.good() )
+  if ( self_test )
   {
-    std::cerr << "Error opening input file: '" << filename << "'\n";
-    return -1;
+    return ( pcjr::crc16_self_test(std::cout) ? 0 : 1 );
   }
 
-  // Determine the file size
-  std::streampos file_size = input_file.tellg();
-  input_file.seekg(0, std::ios::end);
-  file_size = input_file.tellg() - file_size;
-  input_file.seekg(0);
-
-  std::cout << "Input file '" << filename << "' is " << file_size
-	    << " bytes\n";
-
-  const unsigned int number_of_bytes = file_size;
-  char* cartridge_data = 0;
-  try
+  if ( fixup_mode )
   {
-    cartridge_data = new char[number_of_bytes];
+    return ( pcjr::fixup_image(filenames[0].c_str(),
+			       jrc_file,
+			       previous_filename,
+			       patches,
+			       engine,
+			       std::cout) ? 0 : 1 );
   }
-  catch ( const std::bad_alloc& bad_alloc )
-  {
-    std::cerr << "Could not allocate memory!, error '"
-	      << bad_alloc.what() << "'\n";
-    return -1;
-  }
-
-  Register ax;
-  Register bx;
-  Register cx;
-  Register dx;
-
-  cx.x = number_of_bytes;
 
-  // read the data from the file specified so it can be processed
-  unsigned int byte_index = 0;
-  char temp_char;
-  while ( input_file.get(temp_char) )
+  if ( force_mode )
   {
-    assert(byte_index < number_of_bytes);
-
-    cartridge_data[byte_index] = temp_char;
-    ++byte_index;
+    return ( pcjr::force_image(filenames[0].c_str(),
+			       jrc_file ? pcjr::jrc_header_size : 0,
+			       ignore_last_2_characters ? pcjr::crc_size : 0,
+			       force_offset,
+			       force_crc,
+			       engine,
+			       std::cout) ? 0 : 1 );
   }
-  std::cout << "Read " << byte_index << " bytes\n";
 
-  // If we should ignore the last 2 bytes (to simplify CRC calculations
-  // on raw cartridge data), loop 2 less bytes
-  if ( ignore_last_2_characters )
-  {
-    cx.x = cx.x - 2;
-  }
-  if ( jrc_file )
+  if ( scan_mode )
   {
-    // Header will not be processed
-    cx.x = cx.x - jrc_header_size;
-  }
-  std::cout << "bytes to process: " << cx.x << "\n";
+    pcjr::batch_options scan_options = batch_options;
+    scan_options.engine = engine;
 
-  bx.x = cx.x;                  // MOV BX,CX
-  dx.x = 0xFFFF;                // MOV DX, 0FFFFH
-  ax.h = 0;                     // XOR AH,AH
-
-  // Approximation of SI for LODSB
-  unsigned int si = ( !jrc_file ? 0 : jrc_header_size );
+    size_t modules_found = 0;
+    const long failures = pcjr::run_scan(filenames[0].c_str(), scan_base,
+					 scan_options, std::cout,
+					 modules_found);
+    if ( failures < 0 )
+    {
+      return -1;
+    }
 
-  for (; bx.x > 0 ; --bx.x )   // DEC BX, JNZ CRC_1
-  {
-    ax.l  = cartridge_data[si]; // LODSB
-    ++si;                       // increment si as part of LODSB
-    dx.h ^= ax.l;               // XOR DH,AL
-    ax.l  = dx.h;               // MOV AL,DH
-    ax.x  = ax.x << 4;          // ROL AX,CL (CL=4)
-    dx.x ^= ax.x;               // XOR DX,AX
-    ax.x  = ax.x << 1;          // ROL AX,1
-    std::swap(dx.h,dx.l);       // XCHG DH,DL
-    dx.x ^= ax.x;               // XOR DX,AX
-    ax.x  = ax.x >> 4;          // ROR AX,CL (CL=4)
-    ax.l &= 0xE0;               // AND AL,11100000
-    dx.x ^= ax.x;               // XOR DX,AX
-    ax.x  = ax.x >> 1;          // ROR AX,1
-    dx.h ^= ax.l;               // XOR DH,AL
+    std::cerr << modules_found << " modules found, " << failures
+	      << " failed\n";
+    return ( failures == 0 ? 0 : 1 );
   }
 
-  // OR DX,DX V sets appropriate flags based on value of DX.
+  if ( batch_mode )
+  {
+    std::vector<std::string> files;
+    if ( !pcjr::expand_batch_inputs(filenames, files) )
+    {
+      return -1;
+    }
 
-  // Output CRC to terminal
-  std::cout << "CRC: " << std::setw(4) << std::setfill('0')
-	    << std::hex << dx.x << '\n';
+    batch_options.engine = engine;
+    const size_t failures = pcjr::run_batch(files, batch_options, std::cout);
 
-  delete[] cartridge_data;
-  cartridge_data = 0;
+    std::cerr << files.size() << " files verified, " << failures
+	      << " failed\n";
+    return ( failures == 0 ? 0 : 1 );
+  }
 
-  return 0;
+  return crc_file(filenames[0].c_str(),
+		  ignore_last_2_characters,
+		  jrc_file,
+		  stream_input,
+		  use_threads,
+		  batch_options.threads,
+		  covered_length,
+		  covered_crc,
+		  engine);
 }
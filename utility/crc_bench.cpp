@@ -0,0 +1,694 @@
+/*
+ * This file is part of the PCjr/utility distribution (https://github.com/guldmuddypaws/utility).
+ * Copyright (c) 2022 Jason R Neuhaus
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, version 3.
+ *
+ * This program is distributed in the hope that it will be useful, but
+ * WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the GNU
+ * General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program. If not, see <http://www.gnu.org/licenses/>.
+ */
+
+
+// Benchmark and regression suite for the CRC engines, kept apart from the
+// crc command line tool. Every engine is first checked against the
+// emulation of the BIOS assembly (the correctness gate), then timed for
+// block sizes from 16 bytes up to several GiB, with warm and cold caches and
+// aligned and misaligned buffers. Results are written to stdout as JSON so
+// runs can be compared over time, progress goes to stderr.
+//
+// Compile with VS as:
+// cl /EHsc /O2 crc_bench.cpp pcjr_crc.cpp pcjr_crc_clmul.cpp pcjr_file.cpp
+//    pcjr_batch.cpp pcjr_thread_pool.cpp
+// or with g++ as:
+// g++ -std=c++11 -O2 -pthread -o crc_bench crc_bench.cpp pcjr_crc.cpp
+//    pcjr_crc_clmul.cpp pcjr_file.cpp pcjr_batch.cpp pcjr_thread_pool.cpp
+
+#include <algorithm>
+#include <chrono>
+#include <cstdint>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <iostream>
+#include <string>
+#include <thread>
+#include <vector>
+
+#if defined(__x86_64__) || defined(_M_X64) || defined(__i386__) || defined(_M_IX86)
+#define PCJR_BENCH_RDTSC 1
+#ifdef _MSC_VER
+#include <intrin.h>
+#else
+#include <x86intrin.h>
+#endif
+#endif
+
+#ifdef __linux__
+#define PCJR_BENCH_PERF 1
+#include <linux/perf_event.h>
+#include <sys/syscall.h>
+#include <unistd.h>
+#endif
+
+#include "pcjr_batch.h"
+#include "pcjr_crc.h"
+
+namespace
+{
+
+const char max_argument[]     = "/max";
+const char buffer_argument[]  = "/buffer";
+const char threads_argument[] = "/threads";
+const char time_argument[]    = "/time";
+const char engine_argument[]  = "/engine";
+const char gate_argument[]    = "/gate";
+
+const uint64_t kib = 1024;
+const uint64_t mib = 1024 * kib;
+const uint64_t gib = 1024 * mib;
+
+// Buffers are aligned to a cache line, misaligned runs start one byte in
+const size_t buffer_alignment = 64;
+const size_t misalignment     = 1;
+
+// Written between cold runs to push the data out of every cache level
+const size_t evict_size = 64 * mib;
+
+// Largest block the correctness gate runs through the (slow) emulation
+const uint64_t gate_max_size = 16 * mib;
+
+// Upper bound on the time spent on one measurement (all samples)
+const double measurement_budget = 5.0;
+
+const unsigned int warm_samples = 5;
+const unsigned int cold_samples = 21;
+
+// One way of computing the CRC: a single threaded engine, or
+// crc16_parallel() with a number of threads
+struct backend
+{
+  std::string        name;
+  pcjr::crc16_engine engine;
+  unsigned int       threads; // 0 = single threaded engine
+};
+
+struct options
+{
+  uint64_t                  min_size;
+  uint64_t                  max_size;
+  uint64_t                  buffer_size;
+  double                    sample_time;
+  std::vector<unsigned int> threads;
+  std::vector<std::string>  engines;
+  bool                      gate_only;
+
+  options()
+    : min_size(16),
+      max_size(4 * gib),
+      buffer_size(256 * mib),
+      sample_time(0.05),
+      gate_only(false)
+  {
+  }
+};
+
+// Stops the compiler from dropping CRCs nobody looks at
+volatile uint16_t crc_sink;
+
+// perf_event file descriptor counting core cycles of this thread, -1 when
+// the counter is not available
+int cycle_counter = -1;
+
+// Time stamp counter. It ticks at a fixed reference rate, not the core
+// clock, so with turbo or frequency scaling ticks per byte are not cycles
+// per byte.
+uint64_t read_ticks()
+{
+#ifdef PCJR_BENCH_RDTSC
+  return __rdtsc();
+#else
+  return 0;
+#endif
+}
+
+// Open the core cycle counter (Linux perf_event, user space cycles of the
+// calling thread only). Fails without the PMU, e.g. in most virtual
+// machines, or when perf_event_paranoid does not allow it.
+// @return true if the counter opened.
+bool open_cycle_counter()
+{
+#ifdef PCJR_BENCH_PERF
+  perf_event_attr attributes;
+  std::memset(&attributes, 0, sizeof(attributes));
+  attributes.type           = PERF_TYPE_HARDWARE;
+  attributes.size           = sizeof(attributes);
+  attributes.config         = PERF_COUNT_HW_CPU_CYCLES;
+  attributes.exclude_kernel = 1;
+  attributes.exclude_hv     = 1;
+  cycle_counter = static_cast<int>(syscall(__NR_perf_event_open, &attributes,
+                                           0, -1, -1, 0));
+#endif
+  return cycle_counter >= 0;
+}
+
+uint64_t read_cycles()
+{
+  uint64_t cycles = 0;
+#ifdef PCJR_BENCH_PERF
+  if ( cycle_counter >= 0 &&
+       read(cycle_counter, &cycles, sizeof(cycles)) != sizeof(cycles) )
+  {
+    cycles = 0;
+  }
+#endif
+  return cycles;
+}
+
+double now()
+{
+  return std::chrono::duration<double>(
+    std::chrono::steady_clock::now().time_since_epoch()).count();
+}
+
+// Parse a size with an optional k, m or g (binary) suffix
+bool parse_size(const char* text, uint64_t& size)
+{
+  char* end;
+  size = std::strtoull(text, &end, 10);
+  if ( end == text )
+  {
+    return false;
+  }
+  switch ( *end )
+  {
+  case 'k': case 'K': size *= kib; ++end; break;
+  case 'm': case 'M': size *= mib; ++end; break;
+  case 'g': case 'G': size *= gib; ++end; break;
+  default: break;
+  }
+  return *end == '\0' && size > 0;
+}
+
+// Parse "n[,n...]"
+bool parse_list(const char* text, std::vector<unsigned int>& values)
+{
+  values.clear();
+  const char* position = text;
+  for (;;)
+  {
+    char* end;
+    const unsigned long value = std::strtoul(position, &end, 10);
+    if ( end == position || value == 0 )
+    {
+      return false;
+    }
+    values.push_back(static_cast<unsigned int>(value));
+    if ( *end == '\0' )
+    {
+      return true;
+    }
+    if ( *end != ',' )
+    {
+      return false;
+    }
+    position = end + 1;
+  }
+}
+
+std::vector<backend> select_backends(const options& settings)
+{
+  const backend engines[] =
+  {
+    { "emulation", pcjr::crc16_engine_emulation, 0 },
+    { "table",     pcjr::crc16_engine_table,     0 },
+    { "slice8",    pcjr::crc16_engine_slice8,    0 },
+    { "clmul",     pcjr::crc16_engine_clmul,     0 },
+    { "auto",      pcjr::crc16_engine_auto,      0 }
+  };
+
+  std::vector<backend> backends;
+  for ( size_t e = 0 ; e < sizeof(engines) / sizeof(engines[0]) ; ++e )
+  {
+    // clmul silently falls back to slice8 without CPU support, timing it
+    // would only mislead
+    if ( engines[e].engine == pcjr::crc16_engine_clmul &&
+         !pcjr::crc16_clmul_supported() )
+    {
+      continue;
+    }
+    if ( settings.engines.empty() ||
+         std::find(settings.engines.begin(), settings.engines.end(),
+                   engines[e].name) != settings.engines.end() )
+    {
+      backends.push_back(engines[e]);
+    }
+  }
+
+  if ( settings.engines.empty() ||
+       std::find(settings.engines.begin(), settings.engines.end(),
+                 "parallel") != settings.engines.end() )
+  {
+    for ( size_t t = 0 ; t < settings.threads.size() ; ++t )
+    {
+      const backend parallel = { "parallel", pcjr::crc16_engine_auto,
+                                 settings.threads[t] };
+      backends.push_back(parallel);
+    }
+  }
+  return backends;
+}
+
+// Run one backend over length bytes. Blocks bigger than the buffer are
+// processed as repeated passes over it, continuing the CRC from pass to
+// pass, so multi GiB sizes do not need multi GiB of memory.
+uint16_t run_backend(const backend& method,
+                     const uint8_t* data,
+                     uint64_t       buffer_length,
+                     uint64_t       length)
+{
+  uint16_t crc = pcjr::crc16_seed;
+  while ( length > 0 )
+  {
+    const uint64_t pass = std::min(length, buffer_length);
+    if ( method.threads == 0 )
+    {
+      crc = pcjr::crc16(method.engine, data, static_cast<size_t>(pass), crc);
+    }
+    else
+    {
+      crc = pcjr::crc16_parallel(data, pass, method.threads, method.engine,
+                                 crc);
+    }
+    length -= pass;
+  }
+  return crc;
+}
+
+// Touch every cache line of a buffer bigger than the last level cache
+void evict_caches(std::vector<uint8_t>& evict)
+{
+  for ( size_t i = 0 ; i < evict.size() ; i += buffer_alignment )
+  {
+    ++evict[i];
+  }
+}
+
+struct measurement
+{
+  unsigned int samples;
+  uint64_t     iterations; // calls per sample
+  double       min_ns;     // per call
+  double       median_ns;  // per call
+  double       ticks_per_byte; // time stamp counter
+  double       cycles_per_byte; // core cycles of the calling thread
+};
+
+measurement measure(const backend&        method,
+                    const uint8_t*        data,
+                    uint64_t              buffer_length,
+                    uint64_t              length,
+                    bool                  cold,
+                    double                sample_time,
+                    std::vector<uint8_t>& evict)
+{
+  measurement result;
+
+  // Warm up (also the first guess at how long a call takes). For the
+  // parallel backend this also starts the workers crc16_parallel() keeps,
+  // so the samples below do not include starting threads.
+  double start = now();
+  crc_sink = run_backend(method, data, buffer_length, length);
+  const double first_call = std::max(now() - start, 1e-9);
+
+  unsigned int samples = ( cold ? cold_samples : warm_samples );
+  samples = static_cast<unsigned int>(std::max(1.0,
+    std::min<double>(samples, measurement_budget / first_call)));
+
+  // Warm runs repeat the call enough times for the sample to be well above
+  // the timer resolution. Cold runs time a single call after evicting the
+  // caches.
+  result.iterations = 1;
+  if ( !cold )
+  {
+    while ( result.iterations * first_call < sample_time &&
+            result.iterations < ( uint64_t(1) << 30 ) )
+    {
+      result.iterations *= 2;
+    }
+  }
+
+  std::vector<double>   times;
+  std::vector<uint64_t> ticks;
+  std::vector<uint64_t> cycles;
+  for ( unsigned int s = 0 ; s < samples ; ++s )
+  {
+    if ( cold )
+    {
+      evict_caches(evict);
+    }
+    const uint64_t start_cycles = read_cycles();
+    const uint64_t start_ticks  = read_ticks();
+    start = now();
+    for ( uint64_t i = 0 ; i < result.iterations ; ++i )
+    {
+      crc_sink = run_backend(method, data, buffer_length, length);
+    }
+    times.push_back(( now() - start ) * 1e9 /
+                    static_cast<double>(result.iterations));
+    ticks.push_back(read_ticks() - start_ticks);
+    cycles.push_back(read_cycles() - start_cycles);
+  }
+
+  std::vector<double> sorted(times);
+  std::sort(sorted.begin(), sorted.end());
+  std::sort(ticks.begin(), ticks.end());
+  std::sort(cycles.begin(), cycles.end());
+
+  result.samples         = samples;
+  result.min_ns          = sorted.front();
+  result.median_ns       = sorted[sorted.size() / 2];
+  result.ticks_per_byte  = static_cast<double>(ticks[ticks.size() / 2]) /
+    static_cast<double>(result.iterations) / static_cast<double>(length);
+  result.cycles_per_byte = static_cast<double>(cycles[cycles.size() / 2]) /
+    static_cast<double>(result.iterations) / static_cast<double>(length);
+  return result;
+}
+
+// Check every backend against the emulation at each size (and around it),
+// aligned and misaligned.
+bool correctness_gate(const std::vector<backend>&  backends,
+                      const std::vector<uint64_t>& sizes,
+                      const uint8_t*               aligned,
+                      uint64_t                     buffer_length,
+                      unsigned long&               checks,
+                      unsigned long&               failures)
+{
+  checks   = 0;
+  failures = 0;
+
+  for ( size_t s = 0 ; s < sizes.size() && sizes[s] <= gate_max_size ; ++s )
+  {
+    const uint64_t lengths[] = { sizes[s] - 1, sizes[s], sizes[s] + 1,
+                                 sizes[s] + 63 };
+    for ( size_t l = 0 ; l < sizeof(lengths) / sizeof(lengths[0]) ; ++l )
+    {
+      for ( size_t offset = 0 ; offset <= misalignment ; offset += misalignment )
+      {
+        const uint64_t length = lengths[l];
+        if ( length > buffer_length )
+        {
+          continue;
+        }
+        const uint8_t* data = aligned + offset;
+        const uint16_t expected = pcjr::crc16_emulation(
+          data, static_cast<size_t>(length));
+
+        for ( size_t b = 0 ; b < backends.size() ; ++b )
+        {
+          ++checks;
+          const uint16_t actual = run_backend(backends[b], data,
+                                              buffer_length, length);
+          if ( actual != expected )
+          {
+            ++failures;
+            std::fprintf(stderr, "FAIL %s threads %u: length %llu offset "
+                         "%u expected %04x got %04x\n",
+                         backends[b].name.c_str(), backends[b].threads,
+                         static_cast<unsigned long long>(length),
+                         static_cast<unsigned int>(offset), expected, actual);
+          }
+        }
+      }
+    }
+  }
+  return failures == 0;
+}
+
+void print_usage(const char* program)
+{
+  std::cerr << "Usage:\n"
+            << program << " [/max size] [/buffer size] [/threads n[,n...]] "
+               "[/time ms]\n"
+            << std::string(std::strlen(program), ' ')
+            << " [/engine name]... [/gate]\n\n"
+            << "Sizes take an optional k, m or g suffix (1024 based).\n"
+            << "/max size    = largest block to time, from 16 bytes up in "
+               "steps of 4x (default 4g).\n"
+            << "/buffer size = largest buffer to allocate (default 256m), "
+               "bigger blocks are timed\n"
+            << "               as repeated passes over it.\n"
+            << "/threads n   = thread counts for the parallel backend "
+               "(default 2, 4 and one\n"
+            << "               per core). Timed from 2 MiB up, smaller "
+               "blocks run on one thread.\n"
+            << "/time ms     = minimum length of each warm sample (default "
+               "50).\n"
+            << "/engine name = only run this backend (emulation, table, "
+               "slice8, clmul, auto or\n"
+            << "               parallel), repeat for more than one.\n"
+            << "/gate        = only run the correctness gate.\n";
+}
+
+} // namespace
+
+int main(int argc, char* argv[])
+{
+  options settings;
+  bool    invalid_argument = false;
+
+  for ( int i = 1 ; i < argc ; ++i )
+  {
+    const bool has_value = ( i + 1 < argc );
+    if ( std::strcmp(argv[i], max_argument) == 0 )
+    {
+      invalid_argument |= !has_value ||
+        !parse_size(argv[i + 1], settings.max_size);
+      ++i;
+    }
+    else if ( std::strcmp(argv[i], buffer_argument) == 0 )
+    {
+      invalid_argument |= !has_value ||
+        !parse_size(argv[i + 1], settings.buffer_size);
+      ++i;
+    }
+    else if ( std::strcmp(argv[i], threads_argument) == 0 )
+    {
+      invalid_argument |= !has_value ||
+        !parse_list(argv[i + 1], settings.threads);
+      ++i;
+    }
+    else if ( std::strcmp(argv[i], time_argument) == 0 )
+    {
+      std::vector<unsigned int> milliseconds;
+      invalid_argument |= !has_value ||
+        !parse_list(argv[i + 1], milliseconds) || milliseconds.size() != 1;
+      if ( !milliseconds.empty() )
+      {
+        settings.sample_time = milliseconds[0] / 1000.0;
+      }
+      ++i;
+    }
+    else if ( std::strcmp(argv[i], engine_argument) == 0 )
+    {
+      invalid_argument |= !has_value;
+      if ( has_value )
+      {
+        settings.engines.push_back(argv[i + 1]);
+      }
+      ++i;
+    }
+    else if ( std::strcmp(argv[i], gate_argument) == 0 )
+    {
+      settings.gate_only = true;
+    }
+    else
+    {
+      invalid_argument = true;
+    }
+  }
+
+  if ( invalid_argument || settings.max_size < settings.min_size )
+  {
+    std::cerr << "Invalid argument\n";
+    print_usage(argv[0]);
+    return -1;
+  }
+
+  const unsigned int hardware_threads =
+    std::max(1u, std::thread::hardware_concurrency());
+  if ( settings.threads.empty() )
+  {
+    const unsigned int defaults[] = { 2, 4, hardware_threads };
+    settings.threads.assign(defaults, defaults + 3);
+    std::sort(settings.threads.begin(), settings.threads.end());
+    settings.threads.erase(std::unique(settings.threads.begin(),
+                                       settings.threads.end()),
+                           settings.threads.end());
+  }
+
+  const std::vector<backend> backends = select_backends(settings);
+  if ( backends.empty() )
+  {
+    std::cerr << "No backend selected\n";
+    print_usage(argv[0]);
+    return -1;
+  }
+
+  std::vector<uint64_t> sizes;
+  for ( uint64_t size = settings.min_size ;
+        size <= settings.max_size ;
+        size *= 4 )
+  {
+    sizes.push_back(size);
+  }
+
+  // One buffer for every run, with room to start it on a cache line and
+  // then misalign it
+  const uint64_t buffer_length = std::min(settings.buffer_size,
+                                          settings.max_size);
+  std::vector<uint8_t> buffer(static_cast<size_t>(
+    buffer_length + buffer_alignment + misalignment));
+  uint8_t* const aligned = &buffer[0] + ( buffer_alignment -
+    reinterpret_cast<uintptr_t>(&buffer[0]) % buffer_alignment );
+
+  // Fill with xorshift noise, quicker than <random> for hundreds of MiB
+  uint64_t state = 0x9E3779B97F4A7C15ull;
+  for ( size_t i = 0 ; i < buffer.size() ; ++i )
+  {
+    state ^= state << 13;
+    state ^= state >> 7;
+    state ^= state << 17;
+    buffer[i] = static_cast<uint8_t>(state);
+  }
+
+  unsigned long checks;
+  unsigned long failures;
+  std::cerr << "Correctness gate...\n";
+  const bool gate_ok = correctness_gate(backends, sizes, aligned,
+                                        buffer_length, checks, failures);
+  std::cerr << "Correctness gate: " << checks << " checks, " << failures
+            << " failed\n";
+
+  const bool have_cycles = open_cycle_counter();
+
+  std::cout << "{\n"
+            << "  \"tool\": \"crc_bench\",\n"
+            << "  \"cycle_counter\": "
+            << ( have_cycles ? "\"perf_event cpu-cycles, calling thread\"" :
+                               "null" ) << ",\n"
+            << "  \"tick_counter\": "
+#ifdef PCJR_BENCH_RDTSC
+            << "\"rdtsc, reference ticks not core cycles\",\n"
+#else
+            << "null,\n"
+#endif
+            << "  \"parallel_pool\": \"reused, started by the untimed warm "
+               "up call\",\n"
+            << "  \"parallel_min_bytes\": " << pcjr::parallel_split_minimum
+            << ",\n"
+            << "  \"hardware_threads\": " << hardware_threads << ",\n"
+            << "  \"clmul_supported\": "
+            << ( pcjr::crc16_clmul_supported() ? "true" : "false" ) << ",\n"
+            << "  \"buffer_bytes\": " << buffer_length << ",\n"
+            << "  \"evict_bytes\": " << evict_size << ",\n"
+            << "  \"gate\": {\"checks\": " << checks << ", \"failures\": "
+            << failures << "},\n"
+            << "  \"results\": [";
+
+  if ( gate_ok && !settings.gate_only )
+  {
+    std::vector<uint8_t> evict(evict_size);
+    bool first = true;
+
+    for ( size_t b = 0 ; b < backends.size() ; ++b )
+    {
+      for ( size_t s = 0 ; s < sizes.size() ; ++s )
+      {
+        for ( unsigned int run = 0 ; run < 4 ; ++run )
+        {
+          const bool misaligned = ( run % 2 != 0 );
+          const bool cold       = ( run >= 2 );
+
+          // A block bigger than the eviction buffer never fits in the
+          // cache, a cold run would only repeat the warm one
+          if ( cold && sizes[s] >= evict_size )
+          {
+            continue;
+          }
+
+          // Keep the misaligned block inside the buffer
+          const uint64_t pass_length = std::min(buffer_length,
+                                                sizes[s]);
+
+          // crc16_parallel() does passes this short on the calling thread,
+          // the row would only repeat the single threaded auto engine
+          if ( backends[b].threads != 0 &&
+               pass_length < pcjr::parallel_split_minimum )
+          {
+            continue;
+          }
+          const measurement result = measure(
+            backends[b], aligned + ( misaligned ? misalignment : 0 ),
+            pass_length, sizes[s], cold, settings.sample_time, evict);
+          const double gb_per_s = static_cast<double>(sizes[s]) /
+            result.median_ns;
+
+          char line[512];
+          std::snprintf(line, sizeof(line),
+                        "%s\n    {\"backend\": \"%s\", \"threads\": %u, "
+                        "\"size\": %llu, \"alignment\": \"%s\", "
+                        "\"cache\": \"%s\", \"samples\": %u, "
+                        "\"iterations\": %llu, \"ns_per_call_min\": %.1f, "
+                        "\"ns_per_call_median\": %.1f, \"gb_per_s\": %.3f",
+                        first ? "" : ",",
+                        backends[b].name.c_str(),
+                        std::max(1u, backends[b].threads),
+                        static_cast<unsigned long long>(sizes[s]),
+                        misaligned ? "misaligned" : "aligned",
+                        cold ? "cold" : "warm",
+                        result.samples,
+                        static_cast<unsigned long long>(result.iterations),
+                        result.min_ns, result.median_ns, gb_per_s);
+          std::cout << line;
+          // The counter only follows the calling thread, so it misses the
+          // work of the crc16_parallel() workers
+          if ( have_cycles && backends[b].threads == 0 )
+          {
+            std::snprintf(line, sizeof(line), ", \"cycles_per_byte\": %.3f",
+                          result.cycles_per_byte);
+            std::cout << line;
+          }
+          else
+          {
+            std::cout << ", \"cycles_per_byte\": null";
+          }
+#ifdef PCJR_BENCH_RDTSC
+          std::snprintf(line, sizeof(line), ", \"tsc_ticks_per_byte\": %.3f",
+                        result.ticks_per_byte);
+          std::cout << line;
+#endif
+          std::cout << '}';
+          first = false;
+
+          std::fprintf(stderr, "%-9s %2u threads %11llu bytes %-10s %s "
+                       "%12.1f ns %8.3f GB/s\n",
+                       backends[b].name.c_str(),
+                       std::max(1u, backends[b].threads),
+                       static_cast<unsigned long long>(sizes[s]),
+                       misaligned ? "misaligned" : "aligned",
+                       cold ? "cold" : "warm", result.median_ns, gb_per_s);
+        }
+      }
+    }
+  }
+
+  std::cout << "\n  ]\n}\n";
+  return ( gate_ok ? 0 : 2 );
+}
@@ -0,0 +1,545 @@
+/*
+ * This file is part of the PCjr/utility distribution (https://github.com/guldmuddypaws/utility).
+ * Copyright (c) 2022 Jason R Neuhaus
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, version 3.
+ *
+ * This program is distributed in the hope that it will be useful, but
+ * WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the GNU
+ * General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program. If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include "pcjr_batch.h"
+
+#include <cstdio>
+#include <fstream>
+#include <iostream>
+#include <memory>
+#include <mutex>
+
+#include "pcjr_cart.h"
+#include "pcjr_file.h"
+#include "pcjr_thread_pool.h"
+
+namespace
+{
+
+// Files at least this big are split into chunks of chunk_size bytes which
+// are processed by different workers and joined with crc16_combine().
+const uint64_t chunk_size          = 8 * 1024 * 1024;
+const uint64_t split_threshold     = 2 * chunk_size;
+
+// Smaller files are grouped into one task until the group reaches either
+// limit, so the per task overhead stays small next to the CRC itself.
+const uint64_t group_bytes         = 4 * 1024 * 1024;
+const size_t   group_files         = 64;
+
+// Smallest chunk crc16_parallel() hands to a worker. A block that does not
+// make at least 2 chunks is done on the calling thread.
+const uint64_t parallel_minimum_chunk = pcjr::parallel_split_minimum / 2;
+
+// Workers kept between crc16_parallel() calls, so starting and joining
+// threads does not cost more than the CRC of mid-size blocks. Created on the
+// first call and again only when the thread count changes. One call uses
+// them at a time.
+std::mutex                         parallel_mutex;
+std::unique_ptr<pcjr::thread_pool> parallel_pool;
+unsigned int                       parallel_pool_threads = 0;
+
+enum batch_status
+{
+  status_pass,
+  status_fail,
+  status_error
+};
+
+struct batch_entry
+{
+  std::string  path;
+  uint64_t     size;
+  bool         jrc;
+  uint16_t     crc;
+  uint16_t     stored_crc;
+  batch_status status;
+  std::string  error;
+
+  // CRC of each chunk for files that are split across workers
+  std::vector<uint16_t> chunk_crcs;
+
+  batch_entry()
+    : size(0),
+      jrc(false),
+      crc(0),
+      stored_crc(0),
+      status(status_error)
+  {
+  }
+};
+
+// Work out the header type and CRC window of a mapped image.
+// @return false (with the entry marked as an error) if it is too small
+bool set_window(batch_entry&             entry,
+                const pcjr::mapped_file& image,
+                uint64_t&                start,
+                uint64_t&                length)
+{
+  entry.jrc = pcjr::is_jrc_image(entry.path, image.data(), image.size());
+  start     = ( entry.jrc ? pcjr::jrc_header_size : 0 );
+
+  if ( image.size() < start + pcjr::crc_size )
+  {
+    entry.status = status_error;
+    entry.error  = "file too small";
+    return false;
+  }
+
+  length           = image.size() - start - pcjr::crc_size;
+  entry.stored_crc = pcjr::stored_crc(image.data() + image.size());
+  return true;
+}
+
+void set_result(batch_entry& entry)
+{
+  entry.status = ( entry.crc == entry.stored_crc ? status_pass : status_fail );
+}
+
+// Verify a whole file on the calling thread
+void verify_file(batch_entry& entry, pcjr::crc16_engine engine)
+{
+  pcjr::mapped_file image;
+  if ( !image.open(entry.path.c_str()) )
+  {
+    entry.status = status_error;
+    entry.error  = "could not open file";
+    return;
+  }
+  entry.size = image.size();
+
+  uint64_t start;
+  uint64_t length;
+  if ( set_window(entry, image, start, length) )
+  {
+    entry.crc = pcjr::crc16(engine, image.data() + start,
+                            static_cast<size_t>(length));
+    set_result(entry);
+  }
+}
+
+// Quote a string for CSV if it needs it
+std::string csv_field(const std::string& text)
+{
+  if ( text.find_first_of(",\"\r\n") == std::string::npos )
+  {
+    return text;
+  }
+
+  std::string quoted = "\"";
+  for ( size_t i = 0 ; i < text.size() ; ++i )
+  {
+    if ( text[i] == '"' )
+    {
+      quoted += '"';
+    }
+    quoted += text[i];
+  }
+  return quoted + "\"";
+}
+
+std::string json_string(const std::string& text)
+{
+  std::string quoted = "\"";
+  for ( size_t i = 0 ; i < text.size() ; ++i )
+  {
+    const unsigned char c = static_cast<unsigned char>(text[i]);
+    if ( c == '"' || c == '\\' )
+    {
+      quoted += '\\';
+      quoted += static_cast<char>(c);
+    }
+    else if ( c < 0x20 )
+    {
+      char escaped[8];
+      std::snprintf(escaped, sizeof(escaped), "\\u%04x", c);
+      quoted += escaped;
+    }
+    else
+    {
+      quoted += static_cast<char>(c);
+    }
+  }
+  return quoted + "\"";
+}
+
+std::string hex4(uint16_t value)
+{
+  char text[8];
+  std::snprintf(text, sizeof(text), "%04x", value);
+  return text;
+}
+
+const char* status_name(batch_status status)
+{
+  switch ( status )
+  {
+  case status_pass:
+    return "pass";
+  case status_fail:
+    return "fail";
+  case status_error:
+  default:
+    return "error";
+  }
+}
+
+void write_manifest(const std::vector<batch_entry>& entries,
+                    pcjr::manifest_format           format,
+                    std::ostream&                   manifest)
+{
+  if ( format == pcjr::manifest_csv )
+  {
+    manifest << "path,size,header,crc,stored_crc,result,error\n";
+  }
+  else
+  {
+    manifest << "[\n";
+  }
+
+  for ( size_t i = 0 ; i < entries.size() ; ++i )
+  {
+    const batch_entry& entry  = entries[i];
+    const bool         has_crc = ( entry.status != status_error );
+
+    if ( format == pcjr::manifest_csv )
+    {
+      manifest << csv_field(entry.path) << ','
+               << entry.size << ','
+               << ( entry.jrc ? "jrc" : "raw" ) << ','
+               << ( has_crc ? hex4(entry.crc) : "" ) << ','
+               << ( has_crc ? hex4(entry.stored_crc) : "" ) << ','
+               << status_name(entry.status) << ','
+               << csv_field(entry.error) << '\n';
+    }
+    else
+    {
+      manifest << "  {\"path\": " << json_string(entry.path)
+               << ", \"size\": " << entry.size
+               << ", \"header\": \"" << ( entry.jrc ? "jrc" : "raw" ) << '"';
+      if ( has_crc )
+      {
+        manifest << ", \"crc\": \"" << hex4(entry.crc) << '"'
+                 << ", \"stored_crc\": \"" << hex4(entry.stored_crc) << '"';
+      }
+      manifest << ", \"result\": \"" << status_name(entry.status) << '"';
+      if ( !entry.error.empty() )
+      {
+        manifest << ", \"error\": " << json_string(entry.error);
+      }
+      manifest << ( i + 1 < entries.size() ? "},\n" : "}\n" );
+    }
+  }
+
+  if ( format == pcjr::manifest_json )
+  {
+    manifest << "]\n";
+  }
+}
+
+// Queue the CRC of each chunk_length piece of a block on the pool. crcs is
+// resized to hold one result per chunk and must outlive the tasks.
+void submit_chunks(pcjr::thread_pool&     pool,
+                   const uint8_t*         data,
+                   uint64_t               length,
+                   uint64_t               chunk_length,
+                   pcjr::crc16_engine     engine,
+                   uint16_t               seed,
+                   std::vector<uint16_t>& crcs)
+{
+  const size_t chunks = static_cast<size_t>
+    ( ( length + chunk_length - 1 ) / chunk_length );
+  crcs.resize(chunks);
+
+  for ( size_t c = 0 ; c < chunks ; ++c )
+  {
+    const uint8_t* chunk_data = data + c * chunk_length;
+    const uint64_t remaining  = length - c * chunk_length;
+    const size_t   this_chunk = static_cast<size_t>
+      ( remaining < chunk_length ? remaining : chunk_length );
+    uint16_t*      result     = &crcs[c];
+
+    pool.submit([chunk_data, this_chunk, result, engine, seed]()
+                {
+                  *result = pcjr::crc16(engine, chunk_data, this_chunk, seed);
+                });
+  }
+}
+
+// Join the chunk CRCs from submit_chunks() into the CRC of the whole block
+uint16_t join_chunks(const std::vector<uint16_t>& crcs,
+                     uint64_t                     length,
+                     uint64_t                     chunk_length,
+                     uint16_t                     seed)
+{
+  if ( crcs.empty() )
+  {
+    return seed;
+  }
+
+  uint16_t crc = crcs[0];
+  for ( size_t c = 1 ; c < crcs.size() ; ++c )
+  {
+    const uint64_t remaining = length - c * chunk_length;
+    crc = pcjr::crc16_combine(crc, crcs[c],
+                              remaining < chunk_length ?
+                              remaining : chunk_length,
+                              seed);
+  }
+  return crc;
+}
+
+bool has_wildcards(const std::string& path)
+{
+  return path.find_first_of("*?") != std::string::npos;
+}
+
+} // namespace
+
+namespace pcjr
+{
+
+bool expand_batch_inputs(const std::vector<std::string>& inputs,
+                         std::vector<std::string>&       files)
+{
+  bool ok = true;
+
+  for ( size_t i = 0 ; i < inputs.size() ; ++i )
+  {
+    const std::string& input = inputs[i];
+
+    if ( !input.empty() && input[0] == '@' )
+    {
+      // File list, one path per line. Blank lines are skipped.
+      std::ifstream list(input.c_str() + 1);
+      if ( !list.good() )
+      {
+        std::cerr << "Error opening file list: '" << input.substr(1)
+                  << "'\n";
+        ok = false;
+        continue;
+      }
+      std::string line;
+      while ( std::getline(list, line) )
+      {
+        if ( !line.empty() && line[line.size() - 1] == '\r' )
+        {
+          line.erase(line.size() - 1);
+        }
+        if ( !line.empty() )
+        {
+          files.push_back(line);
+        }
+      }
+    }
+    else if ( is_directory(input) )
+    {
+      if ( !list_directory(input, files) )
+      {
+        std::cerr << "Error reading directory: '" << input << "'\n";
+        ok = false;
+      }
+    }
+    else if ( has_wildcards(input) )
+    {
+      if ( !expand_wildcards(input, files) )
+      {
+        std::cerr << "Error reading directory for: '" << input << "'\n";
+        ok = false;
+      }
+    }
+    else
+    {
+      // Plain file, errors opening it are reported in the manifest
+      files.push_back(input);
+    }
+  }
+
+  return ok;
+}
+
+uint16_t crc16_parallel(const uint8_t* data,
+                        uint64_t       length,
+                        unsigned int   threads,
+                        crc16_engine   engine,
+                        uint16_t       seed)
+{
+  if ( length < parallel_split_minimum )
+  {
+    return crc16(engine, data, static_cast<size_t>(length), seed);
+  }
+
+  std::lock_guard<std::mutex> lock(parallel_mutex);
+  if ( !parallel_pool || parallel_pool_threads != threads )
+  {
+    // Stop the old workers before starting the new ones
+    parallel_pool.reset();
+    parallel_pool.reset(new thread_pool(threads));
+    parallel_pool_threads = threads;
+  }
+  thread_pool& pool = *parallel_pool;
+
+  // A few chunks per worker so a slow worker does not hold up the rest, but
+  // never so small that the combine and task overhead shows up.
+  const uint64_t chunks_wanted = static_cast<uint64_t>(pool.size()) * 4;
+  uint64_t chunk_length = ( length + chunks_wanted - 1 ) / chunks_wanted;
+  if ( chunk_length < parallel_minimum_chunk )
+  {
+    chunk_length = parallel_minimum_chunk;
+  }
+
+  std::vector<uint16_t> crcs;
+  submit_chunks(pool, data, length, chunk_length, engine, seed, crcs);
+  pool.wait();
+
+  return join_chunks(crcs, length, chunk_length, seed);
+}
+
+bool crc16_window(const uint8_t* data,
+                  uint64_t       size,
+                  uint64_t       skip,
+                  unsigned int   ignore_tail,
+                  bool           use_threads,
+                  unsigned int   threads,
+                  crc16_engine   engine,
+                  uint16_t&      crc)
+{
+  if ( size < skip + ignore_tail )
+  {
+    return false;
+  }
+
+  const uint64_t length = size - skip - ignore_tail;
+  if ( use_threads )
+  {
+    crc = crc16_parallel(data + skip, length, threads, engine, crc);
+  }
+  else
+  {
+    crc = crc16(engine, data + skip, static_cast<size_t>(length), crc);
+  }
+  return true;
+}
+
+size_t run_batch(const std::vector<std::string>& files,
+                 const batch_options&            options,
+                 std::ostream&                   manifest)
+{
+  std::vector<batch_entry> entries(files.size());
+
+  // Large files stay mapped until their chunks are done
+  std::vector<std::unique_ptr<mapped_file> > large_images;
+
+  {
+    thread_pool pool(options.threads);
+
+    std::vector<size_t> group;
+    uint64_t            group_size = 0;
+
+    for ( size_t i = 0 ; i < files.size() ; ++i )
+    {
+      batch_entry& entry = entries[i];
+      entry.path = files[i];
+
+      if ( !file_size(entry.path, entry.size) )
+      {
+        entry.error = "could not open file";
+        continue;
+      }
+
+      if ( entry.size < split_threshold )
+      {
+        group.push_back(i);
+        group_size += entry.size;
+
+        if ( group_size >= group_bytes || group.size() >= group_files )
+        {
+          const crc16_engine engine = options.engine;
+          pool.submit([&entries, group, engine]()
+                      {
+                        for ( size_t g = 0 ; g < group.size() ; ++g )
+                        {
+                          verify_file(entries[group[g]], engine);
+                        }
+                      });
+          group.clear();
+          group_size = 0;
+        }
+        continue;
+      }
+
+      // Large file, map it here and hand the chunks out to the workers
+      std::unique_ptr<mapped_file> image(new mapped_file);
+      uint64_t start;
+      uint64_t length;
+      if ( !image->open(entry.path.c_str()) )
+      {
+        entry.error = "could not open file";
+        continue;
+      }
+      entry.size = image->size();
+      if ( !set_window(entry, *image, start, length) )
+      {
+        continue;
+      }
+
+      submit_chunks(pool, image->data() + start, length, chunk_size,
+                    options.engine, crc16_seed, entry.chunk_crcs);
+      large_images.push_back(std::move(image));
+    }
+
+    if ( !group.empty() )
+    {
+      const crc16_engine engine = options.engine;
+      pool.submit([&entries, group, engine]()
+                  {
+                    for ( size_t g = 0 ; g < group.size() ; ++g )
+                    {
+                      verify_file(entries[group[g]], engine);
+                    }
+                  });
+    }
+
+    pool.wait();
+  }
+
+  // Join the chunks of the large files back together
+  size_t failures = 0;
+  for ( size_t i = 0 ; i < entries.size() ; ++i )
+  {
+    batch_entry& entry = entries[i];
+    if ( !entry.chunk_crcs.empty() )
+    {
+      const uint64_t start  = ( entry.jrc ? jrc_header_size : 0 );
+      const uint64_t length = entry.size - start - crc_size;
+
+      entry.crc = join_chunks(entry.chunk_crcs, length, chunk_size,
+                              crc16_seed);
+      set_result(entry);
+    }
+
+    if ( entry.status != status_pass )
+    {
+      ++failures;
+    }
+  }
+
+  write_manifest(entries, options.format, manifest);
+
+  return failures;
+}
+
+} // namespace pcjr
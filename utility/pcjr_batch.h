@@ -0,0 +1,132 @@
+/*
+ * This file is part of the PCjr/utility distribution (https://github.com/guldmuddypaws/utility).
+ * Copyright (c) 2022 Jason R Neuhaus
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, version 3.
+ *
+ * This program is distributed in the hope that it will be useful, but
+ * WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the GNU
+ * General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program. If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#ifndef PCJR_BATCH_H
+#define PCJR_BATCH_H
+
+// Batch verification of cartridge/ROM images. Every image is checked the
+// way the BIOS would: the CRC of the module (after any .jrc header, without
+// the trailing 2 bytes) must equal the CRC stored in those 2 bytes. Images
+// are verified concurrently on a thread pool and the results written as a
+// CSV or JSON manifest. Also home to the multi-threaded CRC of a single
+// large block.
+
+#include <cstddef>
+#include <cstdint>
+#include <ostream>
+#include <string>
+#include <vector>
+
+#include "pcjr_crc.h"
+
+namespace pcjr
+{
+
+// Most worker threads /threads accepts. Well past the core count of any
+// machine this runs on, but stops a typo from starting threads until the
+// system refuses.
+static const unsigned int max_threads = 1024;
+
+// Smallest block crc16_parallel() splits across its workers. Anything
+// shorter is processed on the calling thread.
+static const uint64_t parallel_split_minimum = 2 * 1024 * 1024;
+
+enum manifest_format
+{
+  manifest_csv,
+  manifest_json
+};
+
+struct batch_options
+{
+  manifest_format format;
+  unsigned int    threads; // 0 = one per hardware thread, up to max_threads
+  crc16_engine    engine;
+
+  batch_options()
+    : format(manifest_csv),
+      threads(0),
+      engine(crc16_engine_auto)
+  {
+  }
+};
+
+/** Expand the inputs given on the command line into a list of files.
+    An input is a directory (searched recursively), a path with '*' or '?'
+    wildcards in its last component, "@name" for a text file listing one
+    path per line, or a plain filename.
+    @param inputs Inputs to expand
+    @param files Files found are appended here, in input order
+    @return false if an input could not be read (reported on std::cerr).
+*/
+extern bool expand_batch_inputs(const std::vector<std::string>& inputs,
+                                std::vector<std::string>&       files);
+
+/** Compute the CRC of one block of data on several threads. The block is
+    split into chunks, each chunk is processed by a worker and the results
+    are joined with crc16_combine(). The workers are started on the first
+    call and reused by later ones with the same thread count. Blocks under
+    parallel_split_minimum bytes are processed on the calling thread.
+    @param data Pointer to the data to process
+    @param length Number of bytes to process
+    @param threads Number of worker threads, 0 = one per hardware thread
+    @param engine Engine each worker uses
+    @param seed CRC to start from
+    @return CRC of the data, identical to crc16(engine, data, length, seed).
+*/
+extern uint16_t crc16_parallel(const uint8_t* data,
+                               uint64_t       length,
+                               unsigned int   threads,
+                               crc16_engine   engine = crc16_engine_auto,
+                               uint16_t       seed = crc16_seed);
+
+/** Compute the CRC of the window of a mapped file the CRC tool covers, the
+    same window crc16_stream() covers for a stream.
+    @param data Pointer to the whole file
+    @param size Size of the file in bytes
+    @param skip Number of bytes at the start of the file left out of the CRC
+    (the .jrc header plus any bytes already covered by an earlier run)
+    @param ignore_tail Number of bytes at the end of the file left out of the
+    CRC (e.g. the 2 CRC bytes)
+    @param use_threads true to split the window with crc16_parallel()
+    @param threads Number of worker threads for crc16_parallel()
+    @param engine Engine used for the CRC
+    @param crc CRC to start from, updated with the result.
+    @return false if the file is shorter than skip + ignore_tail bytes.
+*/
+extern bool crc16_window(const uint8_t* data,
+                         uint64_t       size,
+                         uint64_t       skip,
+                         unsigned int   ignore_tail,
+                         bool           use_threads,
+                         unsigned int   threads,
+                         crc16_engine   engine,
+                         uint16_t&      crc);
+
+/** Verify every file and write the manifest.
+    @param files Files to verify
+    @param options Output format, thread count and CRC engine
+    @param manifest Stream the manifest is written to
+    @return Number of files that failed verification or could not be read.
+*/
+extern size_t run_batch(const std::vector<std::string>& files,
+                        const batch_options&            options,
+                        std::ostream&                   manifest);
+
+} // namespace pcjr
+
+#endif // PCJR_BATCH_H
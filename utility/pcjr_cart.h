@@ -0,0 +1,95 @@
+/*
+ * This file is part of the PCjr/utility distribution (https://github.com/guldmuddypaws/utility).
+ * Copyright (c) 2022 Jason R Neuhaus
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, version 3.
+ *
+ * This program is distributed in the hope that it will be useful, but
+ * WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the GNU
+ * General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program. If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#ifndef PCJR_CART_H
+#define PCJR_CART_H
+
+// Layout of PCjr cartridge images, see pcjr_cart_template.asm.
+//
+// A raw image (.car/.bin) is the ROM module itself: 0x55 0xAA, the module
+// length in 512 byte blocks, the code, and the 2 byte CRC (high byte first)
+// at the very end. A .jrc image is the same module preceded by a 512 byte
+// header starting with the text "PCjr Cartridge image file".
+
+#include <cctype>
+#include <cstdint>
+#include <cstring>
+#include <string>
+
+namespace pcjr
+{
+
+static const unsigned short jrc_header_size = 512; // 0x200
+static const unsigned short crc_size        = 2;
+
+// A module is 0x55 0xAA followed by its length in blocks of this size
+static const unsigned short module_block_size = 512;
+static const unsigned short max_module_blocks = 255;
+static const uint8_t        module_signature[2] = { 0x55, 0xAA };
+// Offset of the length byte from the start of the module
+static const unsigned short module_length_offset = 2;
+// The BIOS looks for modules on every boundary of this size
+static const unsigned short rom_scan_step = 2048;
+
+static const char jrc_signature[]  = "PCjr Cartridge image file";
+static const char jrc_extension[]  = ".jrc";
+
+/** Decide if an image has a .jrc header, either from the file extension or
+    from the signature at the start of the header.
+    @param filename Name of the image file
+    @param data Contents of the file
+    @param size Size of the file in bytes
+    @return true if the image is in .jrc format.
+*/
+inline bool is_jrc_image(const std::string& filename,
+                         const uint8_t*     data,
+                         uint64_t           size)
+{
+  const size_t extension_length = sizeof(jrc_extension) - 1;
+  if ( filename.size() >= extension_length )
+  {
+    bool extension_match = true;
+    for ( size_t i = 0 ; i < extension_length ; ++i )
+    {
+      const char c = filename[filename.size() - extension_length + i];
+      if ( std::tolower(static_cast<unsigned char>(c)) != jrc_extension[i] )
+      {
+        extension_match = false;
+      }
+    }
+    if ( extension_match )
+    {
+      return true;
+    }
+  }
+
+  const size_t signature_length = sizeof(jrc_signature) - 1;
+  return size >= jrc_header_size &&
+    std::memcmp(data, jrc_signature, signature_length) == 0;
+}
+
+/** Read the CRC stored in the last 2 bytes of a module (high byte first).
+    @param module_end Pointer just past the end of the module
+*/
+inline uint16_t stored_crc(const uint8_t* module_end)
+{
+  return static_cast<uint16_t>( ( module_end[-2] << 8 ) | module_end[-1] );
+}
+
+} // namespace pcjr
+
+#endif // PCJR_CART_H
@@ -6,6 +6,8 @@
 	;; To comile as a PCjr cartridge binary:
 	;; Requires setup of program length and CRC, see comments.
 	;; nasm -f bin pcjr_cart_template.asm -o XXXXX.car
+	;; The length byte and CRC can then be filled in with:
+	;; crc /fixup XXXXX.car
 
 	use16
 
@@ -56,6 +58,6 @@ start:
 	;; the CRC.
         %ifndef com_file
 	times program_length-($-$$) db 0x00
-	;; Insert CRC here (modify this!)
+	;; Insert CRC here (modify this!, or run crc /fixup on the output)
 	db 0xe1,0x4e		  ; CRC
 	%endif
@@ -0,0 +1,427 @@
+/*
+ * This file is part of the PCjr/utility distribution (https://github.com/guldmuddypaws/utility).
+ * Copyright (c) 2022 Jason R Neuhaus
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, version 3.
+ *
+ * This program is distributed in the hope that it will be useful, but
+ * WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the GNU
+ * General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program. If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include "pcjr_crc.h"
+
+#include <utility> // for C++ 98, include <algorithm> instead
+
+namespace
+{
+
+union Register
+{
+  uint16_t x; // ax,bx,etc.
+  struct
+  {
+    uint8_t l; // al,bl,etc.
+    uint8_t h; // ah,bh, etc.
+  };
+};
+
+static const uint16_t crc16_polynomial = 0x1021;
+
+// Below this many bytes the setup of the carry-less multiply engine costs
+// more than it saves.
+static const size_t crc16_clmul_threshold = 128;
+
+// Below this many bytes there are too few whole 8 byte slices for the
+// slicing engine to pay for its wider tables, the plain table engine wins.
+static const size_t crc16_slice8_threshold = 16;
+
+// Lookup tables for the table and slicing engines.
+// table[0][b] is the CRC (seeded with 0) of the single byte b.
+// table[k][b] is the CRC (seeded with 0) of the byte b followed by k zero
+// bytes, which lets 8 bytes be looked up independently and XORed together.
+struct crc16_tables
+{
+  uint16_t table[8][256];
+
+  crc16_tables()
+  {
+    for ( unsigned int byte = 0 ; byte < 256 ; ++byte )
+    {
+      uint16_t crc = static_cast<uint16_t>(byte << 8);
+      for ( unsigned int bit = 0 ; bit < 8 ; ++bit )
+      {
+        crc = static_cast<uint16_t>( ( crc & 0x8000 ) ?
+                                     ( crc << 1 ) ^ crc16_polynomial :
+                                     ( crc << 1 ) );
+      }
+      table[0][byte] = crc;
+    }
+
+    for ( unsigned int slice = 1 ; slice < 8 ; ++slice )
+    {
+      for ( unsigned int byte = 0 ; byte < 256 ; ++byte )
+      {
+        const uint16_t previous = table[slice - 1][byte];
+        table[slice][byte] = static_cast<uint16_t>( ( previous << 8 ) ^
+                                                    table[0][previous >> 8] );
+      }
+    }
+  }
+};
+
+const crc16_tables& tables()
+{
+  static const crc16_tables instance;
+  return instance;
+}
+
+// a * b mod P, carry-less
+uint16_t multiply_mod(uint16_t a, uint16_t b)
+{
+  uint32_t product = 0;
+  for ( unsigned int bit = 0 ; bit < 16 ; ++bit )
+  {
+    if ( b & ( 1u << bit ) )
+    {
+      product ^= static_cast<uint32_t>(a) << bit;
+    }
+  }
+
+  for ( unsigned int bit = 31 ; bit >= 16 ; --bit )
+  {
+    if ( product & ( 1u << bit ) )
+    {
+      product ^= ( 0x10000u | crc16_polynomial ) << ( bit - 16 );
+    }
+  }
+
+  return static_cast<uint16_t>(product);
+}
+
+// power[k] is x^(8 * 2^k) mod P, the effect of 2^k zero bytes on the CRC
+struct crc16_powers
+{
+  uint16_t power[64];
+
+  crc16_powers()
+  {
+    power[0] = 0x0100; // x^8
+    for ( unsigned int k = 1 ; k < 64 ; ++k )
+    {
+      power[k] = multiply_mod(power[k - 1], power[k - 1]);
+    }
+  }
+};
+
+const crc16_powers& powers()
+{
+  static const crc16_powers instance;
+  return instance;
+}
+
+// Longest block checked by crc16_verify(): past the 8 byte slices, and
+// several 64 byte folds either side of the 128 byte carry-less multiply
+// threshold with every 16 byte remainder and tail.
+static const size_t verify_max_length = 320;
+
+} // namespace
+
+namespace pcjr
+{
+
+uint16_t crc16_emulation(const uint8_t* data,
+                         size_t         length,
+                         uint16_t       crc)
+{
+  Register ax;
+  Register dx;
+
+  dx.x = crc;                   // MOV DX, 0FFFFH
+  ax.h = 0;                     // XOR AH,AH
+
+  // Approximation of SI for LODSB
+  const uint8_t* si = data;
+
+  for (; length > 0 ; --length ) // DEC BX, JNZ CRC_1
+  {
+    ax.l  = *si;                // LODSB
+    ++si;                       // increment si as part of LODSB
+    dx.h ^= ax.l;               // XOR DH,AL
+    ax.l  = dx.h;               // MOV AL,DH
+    ax.x  = ax.x << 4;          // ROL AX,CL (CL=4)
+    dx.x ^= ax.x;               // XOR DX,AX
+    ax.x  = ax.x << 1;          // ROL AX,1
+    std::swap(dx.h,dx.l);       // XCHG DH,DL
+    dx.x ^= ax.x;               // XOR DX,AX
+    ax.x  = ax.x >> 4;          // ROR AX,CL (CL=4)
+    ax.l &= 0xE0;               // AND AL,11100000
+    dx.x ^= ax.x;               // XOR DX,AX
+    ax.x  = ax.x >> 1;          // ROR AX,1
+    dx.h ^= ax.l;               // XOR DH,AL
+  }
+
+  // OR DX,DX - sets appropriate flags based on value of DX.
+
+  return dx.x;
+}
+
+uint16_t crc16_table(const uint8_t* data,
+                     size_t         length,
+                     uint16_t       crc)
+{
+  const uint16_t* table = tables().table[0];
+
+  for (; length > 0 ; --length )
+  {
+    crc = static_cast<uint16_t>( ( crc << 8 ) ^ table[( crc >> 8 ) ^ *data] );
+    ++data;
+  }
+
+  return crc;
+}
+
+uint16_t crc16_slice8(const uint8_t* data,
+                      size_t         length,
+                      uint16_t       crc)
+{
+  const crc16_tables& t = tables();
+
+  // The CRC only overlaps the first 2 bytes of each 8 byte slice, the
+  // remaining 6 bytes are looked up as is.
+  for (; length >= 8 ; length -= 8 )
+  {
+    crc = static_cast<uint16_t>( t.table[7][data[0] ^ ( crc >> 8 )] ^
+                                 t.table[6][data[1] ^ ( crc & 0xFF )] ^
+                                 t.table[5][data[2]] ^
+                                 t.table[4][data[3]] ^
+                                 t.table[3][data[4]] ^
+                                 t.table[2][data[5]] ^
+                                 t.table[1][data[6]] ^
+                                 t.table[0][data[7]] );
+    data += 8;
+  }
+
+  return crc16_table(data, length, crc);
+}
+
+uint16_t crc16(const uint8_t* data,
+               size_t         length,
+               uint16_t       crc)
+{
+  if ( length >= crc16_clmul_threshold && crc16_clmul_supported() )
+  {
+    return crc16_clmul(data, length, crc);
+  }
+  if ( length >= crc16_slice8_threshold )
+  {
+    return crc16_slice8(data, length, crc);
+  }
+  return crc16_table(data, length, crc);
+}
+
+uint16_t crc16(crc16_engine   engine,
+               const uint8_t* data,
+               size_t         length,
+               uint16_t       crc)
+{
+  switch ( engine )
+  {
+  case crc16_engine_emulation:
+    return crc16_emulation(data, length, crc);
+  case crc16_engine_table:
+    return crc16_table(data, length, crc);
+  case crc16_engine_slice8:
+    return crc16_slice8(data, length, crc);
+  case crc16_engine_clmul:
+    return crc16_clmul(data, length, crc);
+  case crc16_engine_auto:
+  default:
+    return crc16(data, length, crc);
+  }
+}
+
+uint16_t crc16_shift(uint16_t crc,
+                     uint64_t length)
+{
+  const crc16_powers& p = powers();
+
+  for ( unsigned int k = 0 ; length > 0 ; ++k, length >>= 1 )
+  {
+    if ( length & 1 )
+    {
+      crc = multiply_mod(crc, p.power[k]);
+    }
+  }
+
+  return crc;
+}
+
+uint16_t crc16_combine(uint16_t crc_a,
+                       uint16_t crc_b,
+                       uint64_t length_b,
+                       uint16_t seed)
+{
+  // crc_b already includes the seed advanced over block b. Replacing it
+  // with crc_a is the same as XORing (crc_a ^ seed) advanced over block b.
+  return static_cast<uint16_t>( crc16_shift(crc_a ^ seed, length_b) ^ crc_b );
+}
+
+uint16_t crc16_patch(uint16_t       crc,
+                     uint64_t       block_length,
+                     uint64_t       offset,
+                     const uint8_t* old_data,
+                     const uint8_t* new_data,
+                     size_t         length)
+{
+  // CRC (seeded with 0) of the difference between the old and new bytes,
+  // a piece at a time so no buffer the size of the patch is needed
+  uint8_t  difference[256];
+  uint16_t difference_crc = 0;
+
+  for ( size_t done = 0 ; done < length ; )
+  {
+    size_t piece = length - done;
+    if ( piece > sizeof(difference) )
+    {
+      piece = sizeof(difference);
+    }
+    for ( size_t i = 0 ; i < piece ; ++i )
+    {
+      difference[i] = static_cast<uint8_t>( old_data[done + i] ^
+                                            new_data[done + i] );
+    }
+    difference_crc = crc16(difference, piece, difference_crc);
+    done += piece;
+  }
+
+  // Carry the difference through the unchanged bytes after the patch
+  return static_cast<uint16_t>( crc ^
+                                crc16_shift(difference_crc,
+                                            block_length - offset - length) );
+}
+
+bool crc16_force(uint16_t crc_zeroed,
+                 uint64_t length_after,
+                 uint16_t target,
+                 uint8_t  patch[2])
+{
+  // Setting the patch bytes to v changes the CRC by a linear function of v:
+  // the CRC (seeded with 0) of the 2 bytes, advanced over the bytes after
+  // them. Build its 16x16 matrix over GF(2), one column per bit of v, and
+  // solve matrix * v = target ^ crc_zeroed by Gaussian elimination. Each row
+  // is kept as the 16 coefficient bits plus the right hand side in bit 16.
+  const uint16_t wanted = static_cast<uint16_t>( target ^ crc_zeroed );
+
+  uint32_t rows[16];
+  for ( unsigned int row = 0 ; row < 16 ; ++row )
+  {
+    rows[row] = ( ( wanted >> row ) & 1u ) << 16;
+  }
+  for ( unsigned int column = 0 ; column < 16 ; ++column )
+  {
+    const uint8_t bytes[2] =
+    {
+      static_cast<uint8_t>( ( 1u << column ) >> 8 ),
+      static_cast<uint8_t>( 1u << column )
+    };
+    const uint16_t effect = crc16_shift(crc16_table(bytes, 2, 0),
+                                        length_after);
+    for ( unsigned int row = 0 ; row < 16 ; ++row )
+    {
+      rows[row] |= ( ( effect >> row ) & 1u ) << column;
+    }
+  }
+
+  for ( unsigned int column = 0 ; column < 16 ; ++column )
+  {
+    unsigned int pivot = column;
+    while ( pivot < 16 && !( rows[pivot] & ( 1u << column ) ) )
+    {
+      ++pivot;
+    }
+    if ( pivot == 16 )
+    {
+      // Singular, not possible while x is invertible mod the polynomial
+      return false;
+    }
+    std::swap(rows[column], rows[pivot]);
+    for ( unsigned int row = 0 ; row < 16 ; ++row )
+    {
+      if ( row != column && ( rows[row] & ( 1u << column ) ) )
+      {
+        rows[row] ^= rows[column];
+      }
+    }
+  }
+
+  // Reduced to the identity, row i now holds bit i of v
+  uint16_t value = 0;
+  for ( unsigned int row = 0 ; row < 16 ; ++row )
+  {
+    value = static_cast<uint16_t>( value | ( ( rows[row] >> 16 ) << row ) );
+  }
+  patch[0] = static_cast<uint8_t>( value >> 8 );
+  patch[1] = static_cast<uint8_t>( value );
+  return true;
+}
+
+bool crc16_verify(crc16_engine engine)
+{
+  const uint8_t digits[] = { '1', '2', '3', '4', '5', '6', '7', '8', '9' };
+  if ( crc16(engine, digits, sizeof(digits)) != 0x29B1 ||
+       crc16_emulation(digits, sizeof(digits)) != 0x29B1 )
+  {
+    return false;
+  }
+
+  // Fixed xorshift sequence so a failure is repeatable
+  uint8_t  data[verify_max_length + 16];
+  uint32_t state = 0x2545F491;
+  for ( size_t i = 0 ; i < sizeof(data) ; ++i )
+  {
+    state ^= state << 13;
+    state ^= state >> 17;
+    state ^= state << 5;
+    data[i] = static_cast<uint8_t>( state >> 24 );
+  }
+
+  for ( size_t length = 0 ; length <= verify_max_length ; ++length )
+  {
+    const uint8_t* start = data + length % 16;
+    const uint16_t seed  = ( length % 2 == 0 ? crc16_seed :
+                             static_cast<uint16_t>( state + length ) );
+    if ( crc16(engine, start, length, seed) !=
+         crc16_emulation(start, length, seed) )
+    {
+      return false;
+    }
+  }
+  return true;
+}
+
+const char* crc16_engine_name(crc16_engine engine)
+{
+  switch ( engine )
+  {
+  case crc16_engine_emulation:
+    return "emulation";
+  case crc16_engine_table:
+    return "table";
+  case crc16_engine_slice8:
+    return "slice8";
+  case crc16_engine_clmul:
+    return "clmul";
+  case crc16_engine_auto:
+  default:
+    return "auto";
+  }
+}
+
+} // namespace pcjr
@@ -0,0 +1,174 @@
+/*
+ * This file is part of the PCjr/utility distribution (https://github.com/guldmuddypaws/utility).
+ * Copyright (c) 2022 Jason R Neuhaus
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, version 3.
+ *
+ * This program is distributed in the hope that it will be useful, but
+ * WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the GNU
+ * General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program. If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#ifndef PCJR_CRC_H
+#define PCJR_CRC_H
+
+// Library version of the PCjr BIOS CRC routine (CRC_CHECK in the BIOS
+// listing). The polynomial is the CCITT one (x^16 + x^12 + x^5 + 1, 0x1021),
+// processed most significant bit first, seeded with 0xFFFF and with no final
+// XOR. A ROM module is valid when the CRC over the whole module, including
+// the 2 trailing CRC bytes, is 0.
+
+#include <cstddef>
+#include <cstdint>
+
+namespace pcjr
+{
+
+// Seed the BIOS loads into DX before running the CRC loop.
+static const uint16_t crc16_seed = 0xFFFF;
+
+// Available implementations of the CRC. All of them produce identical
+// results, they only differ in speed.
+enum crc16_engine
+{
+  crc16_engine_emulation, // Replays the BIOS assembly one byte at a time
+  crc16_engine_table,     // 256 entry lookup table, one byte per step
+  crc16_engine_slice8,    // Slicing-by-8, eight bytes per step
+  crc16_engine_clmul,     // Carry-less multiply folding, 64 bytes per step
+  crc16_engine_auto       // Fastest engine available
+};
+
+/** Compute the CRC of a block of data using the fastest available engine.
+    Three tiers: carry-less multiply when the CPU supports it and the block is
+    at least 128 bytes, slicing-by-8 from 16 bytes, and the table engine (the
+    scalar tier, one byte per step) for anything shorter.
+    @param data Pointer to the data to process
+    @param length Number of bytes to process
+    @param crc CRC to start from. Use the default for a fresh CRC or pass in
+    the result of a previous call to continue where it left off.
+    @return CRC of the data.
+*/
+extern uint16_t crc16(const uint8_t* data,
+                      size_t         length,
+                      uint16_t       crc = crc16_seed);
+
+/** Compute the CRC of a block of data using a specific engine.
+    @param engine Engine to use for the computation
+    @param data Pointer to the data to process
+    @param length Number of bytes to process
+    @param crc CRC to start from.
+    @return CRC of the data.
+*/
+extern uint16_t crc16(crc16_engine   engine,
+                      const uint8_t* data,
+                      size_t         length,
+                      uint16_t       crc = crc16_seed);
+
+/** Reference implementation. Step by step emulation of the BIOS assembly
+    using 8088 style registers. Slow, but it is the definition every other
+    engine is checked against.
+*/
+extern uint16_t crc16_emulation(const uint8_t* data,
+                                size_t         length,
+                                uint16_t       crc = crc16_seed);
+
+/** Table driven implementation, one table lookup per byte. */
+extern uint16_t crc16_table(const uint8_t* data,
+                            size_t         length,
+                            uint16_t       crc = crc16_seed);
+
+/** Slicing-by-8 implementation, eight independent table lookups per 8 bytes
+    which removes most of the byte to byte dependency chain.
+*/
+extern uint16_t crc16_slice8(const uint8_t* data,
+                             size_t         length,
+                             uint16_t       crc = crc16_seed);
+
+/** Carry-less multiply (PCLMULQDQ) folding implementation. Falls back to
+    slicing-by-8 when the CPU does not support it or the block is shorter than
+    64 bytes.
+*/
+extern uint16_t crc16_clmul(const uint8_t* data,
+                            size_t         length,
+                            uint16_t       crc = crc16_seed);
+
+/** @return true if the CPU supports the carry-less multiply engine. */
+extern bool crc16_clmul_supported();
+
+/** Advance a CRC over a run of zero bytes without touching any data. This
+    is multiplication by x^(8 * length) mod P and takes O(log length) steps.
+    @param crc CRC to advance
+    @param length Number of zero bytes
+    @return CRC after length zero bytes.
+*/
+extern uint16_t crc16_shift(uint16_t crc,
+                            uint64_t length);
+
+/** Join the CRCs of two adjacent blocks of data without reprocessing them.
+    Both CRCs must have been computed from the same seed.
+    @param crc_a CRC of the first block
+    @param crc_b CRC of the second block
+    @param length_b Length of the second block in bytes
+    @param seed Seed both CRCs were computed from
+    @return CRC of the first block followed by the second block.
+*/
+extern uint16_t crc16_combine(uint16_t crc_a,
+                              uint16_t crc_b,
+                              uint64_t length_b,
+                              uint16_t seed = crc16_seed);
+
+/** Update the CRC of a block after some of its bytes changed, without
+    reprocessing the rest of the block. The CRC is linear, so the change in
+    CRC only depends on the XOR of the old and new bytes and their distance
+    from the end of the block.
+    @param crc CRC of the block before the change
+    @param block_length Length of the whole block in bytes
+    @param offset Offset of the changed bytes within the block
+    @param old_data The bytes before the change
+    @param new_data The bytes after the change
+    @param length Number of changed bytes
+    @return CRC of the block after the change.
+*/
+extern uint16_t crc16_patch(uint16_t       crc,
+                            uint64_t       block_length,
+                            uint64_t       offset,
+                            const uint8_t* old_data,
+                            const uint8_t* new_data,
+                            size_t         length);
+
+/** Find the value of 2 bytes anywhere in a block that gives the block a
+    chosen CRC. The CRC is linear in those bytes, so this solves a 16x16
+    system over GF(2) built with crc16_shift() and never touches the data.
+    @param crc_zeroed CRC of the block with the 2 bytes set to 0
+    @param length_after Number of bytes in the block after the 2 bytes
+    @param target CRC the block should have
+    @param patch Set to the 2 bytes to store, in order
+    @return false if there is no solution (does not happen for the CCITT
+    polynomial, every target can be reached).
+*/
+extern bool crc16_force(uint16_t crc_zeroed,
+                        uint64_t length_after,
+                        uint16_t target,
+                        uint8_t  patch[2]);
+
+/** Quick check of an engine against the emulation of the BIOS assembly: the
+    CCITT-FALSE known answer ("123456789" gives 0x29B1) and pseudo random
+    blocks of every length through the short block and tail paths of the
+    engines, at misaligned starts and from different seeds.
+    @param engine Engine to check
+    @return true if every result matches the emulation bit for bit.
+*/
+extern bool crc16_verify(crc16_engine engine);
+
+/** Name of an engine, suitable for printing. */
+extern const char* crc16_engine_name(crc16_engine engine);
+
+} // namespace pcjr
+
+#endif // PCJR_CRC_H
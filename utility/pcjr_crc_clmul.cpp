@@ -0,0 +1,211 @@
+/*
+ * This file is part of the PCjr/utility distribution (https://github.com/guldmuddypaws/utility).
+ * Copyright (c) 2022 Jason R Neuhaus
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, version 3.
+ *
+ * This program is distributed in the hope that it will be useful, but
+ * WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the GNU
+ * General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program. If not, see <http://www.gnu.org/licenses/>.
+ */
+
+// Carry-less multiply (PCLMULQDQ) folding engine for the BIOS CRC.
+//
+// The data is treated as one large polynomial over GF(2), first byte / most
+// significant bit first. Four 128 bit accumulators each hold a slice of the
+// message. Every iteration multiplies each accumulator by x^512 mod P (split
+// into its two 64 bit halves) and adds in the next 64 bytes. As P only has
+// degree 16, the products are at most 80 bits and always fit back into 128
+// bits, so the accumulators stay congruent to the message mod P. Once the
+// data runs out the accumulators are folded into one and the remaining
+// 16 bytes (plus any tail) are finished with the table engine.
+//
+// Only compiled on x86. The instructions are enabled per function so the rest
+// of the program does not require them, and the CPU is checked at run time
+// before they are used.
+
+#include "pcjr_crc.h"
+
+#if defined(__x86_64__) || defined(_M_X64) || defined(__i386__) || defined(_M_IX86)
+#define PCJR_CRC_CLMUL 1
+#endif
+
+#ifdef PCJR_CRC_CLMUL
+
+#include <emmintrin.h>
+#include <tmmintrin.h>
+#include <wmmintrin.h>
+
+#ifdef _MSC_VER
+#include <intrin.h>
+#define PCJR_CRC_CLMUL_TARGET
+#else
+#include <cpuid.h>
+#define PCJR_CRC_CLMUL_TARGET __attribute__((target("pclmul,ssse3")))
+#endif
+
+namespace
+{
+
+// x^t mod P for the distances the accumulators are folded across.
+struct clmul_constants
+{
+  __m128i fold_512; // x^576, x^512 - one 64 byte iteration
+  __m128i fold_384; // x^448, x^384 - accumulator 0 into accumulator 3
+  __m128i fold_256; // x^320, x^256 - accumulator 1 into accumulator 3
+  __m128i fold_128; // x^192, x^128 - accumulator 2 into 3, and 16 byte steps
+
+  static long long x_pow_mod(unsigned int exponent)
+  {
+    uint32_t remainder = 1;
+    for ( ; exponent > 0 ; --exponent )
+    {
+      remainder <<= 1;
+      if ( remainder & 0x10000 )
+      {
+        remainder ^= 0x11021;
+      }
+    }
+    return remainder;
+  }
+
+  clmul_constants()
+  {
+    fold_512 = _mm_set_epi64x(x_pow_mod(576), x_pow_mod(512));
+    fold_384 = _mm_set_epi64x(x_pow_mod(448), x_pow_mod(384));
+    fold_256 = _mm_set_epi64x(x_pow_mod(320), x_pow_mod(256));
+    fold_128 = _mm_set_epi64x(x_pow_mod(192), x_pow_mod(128));
+  }
+};
+
+const clmul_constants& constants()
+{
+  static const clmul_constants instance;
+  return instance;
+}
+
+bool detect_clmul()
+{
+  unsigned int ecx = 0;
+#ifdef _MSC_VER
+  int registers[4];
+  __cpuid(registers, 1);
+  ecx = static_cast<unsigned int>(registers[2]);
+#else
+  unsigned int eax, ebx, edx;
+  if ( !__get_cpuid(1, &eax, &ebx, &ecx, &edx) )
+  {
+    return false;
+  }
+#endif
+  const unsigned int pclmulqdq = 1 << 1;
+  const unsigned int ssse3     = 1 << 9;
+  return ( ecx & ( pclmulqdq | ssse3 ) ) == ( pclmulqdq | ssse3 );
+}
+
+// Load 16 bytes so the first byte ends up in the most significant position.
+PCJR_CRC_CLMUL_TARGET
+inline __m128i load_reflected(const uint8_t* data, __m128i byte_swap)
+{
+  return _mm_shuffle_epi8(
+    _mm_loadu_si128(reinterpret_cast<const __m128i*>(data)), byte_swap);
+}
+
+// accumulator * x^distance mod P (congruent, not fully reduced)
+PCJR_CRC_CLMUL_TARGET
+inline __m128i fold(__m128i accumulator, __m128i constant)
+{
+  return _mm_xor_si128(_mm_clmulepi64_si128(accumulator, constant, 0x11),
+                       _mm_clmulepi64_si128(accumulator, constant, 0x00));
+}
+
+PCJR_CRC_CLMUL_TARGET
+uint16_t crc16_clmul_kernel(const uint8_t* data,
+                            size_t         length,
+                            uint16_t       crc)
+{
+  const clmul_constants& k = constants();
+  const __m128i byte_swap = _mm_set_epi8(0, 1, 2, 3, 4, 5, 6, 7,
+                                         8, 9, 10, 11, 12, 13, 14, 15);
+
+  __m128i x0 = load_reflected(data, byte_swap);
+  __m128i x1 = load_reflected(data + 16, byte_swap);
+  __m128i x2 = load_reflected(data + 32, byte_swap);
+  __m128i x3 = load_reflected(data + 48, byte_swap);
+
+  // Seeding the CRC is the same as XORing the seed into the first 2 bytes
+  x0 = _mm_xor_si128(x0, _mm_set_epi64x(static_cast<long long>
+                                        ( static_cast<uint64_t>(crc) << 48 ),
+                                        0));
+  data   += 64;
+  length -= 64;
+
+  for (; length >= 64 ; length -= 64 )
+  {
+    x0 = _mm_xor_si128(fold(x0, k.fold_512), load_reflected(data, byte_swap));
+    x1 = _mm_xor_si128(fold(x1, k.fold_512),
+                       load_reflected(data + 16, byte_swap));
+    x2 = _mm_xor_si128(fold(x2, k.fold_512),
+                       load_reflected(data + 32, byte_swap));
+    x3 = _mm_xor_si128(fold(x3, k.fold_512),
+                       load_reflected(data + 48, byte_swap));
+    data += 64;
+  }
+
+  x3 = _mm_xor_si128(x3, fold(x0, k.fold_384));
+  x3 = _mm_xor_si128(x3, fold(x1, k.fold_256));
+  x3 = _mm_xor_si128(x3, fold(x2, k.fold_128));
+
+  for (; length >= 16 ; length -= 16 )
+  {
+    x3 = _mm_xor_si128(fold(x3, k.fold_128), load_reflected(data, byte_swap));
+    data += 16;
+  }
+
+  // The accumulator now holds 16 bytes congruent to everything processed so
+  // far. Run it, followed by the tail, through the table engine with a 0 seed
+  uint8_t remainder[16];
+  _mm_storeu_si128(reinterpret_cast<__m128i*>(remainder),
+                   _mm_shuffle_epi8(x3, byte_swap));
+
+  crc = pcjr::crc16_table(remainder, sizeof(remainder), 0);
+  return pcjr::crc16_table(data, length, crc);
+}
+
+} // namespace
+
+#endif // PCJR_CRC_CLMUL
+
+namespace pcjr
+{
+
+bool crc16_clmul_supported()
+{
+#ifdef PCJR_CRC_CLMUL
+  static const bool supported = detect_clmul();
+  return supported;
+#else
+  return false;
+#endif
+}
+
+uint16_t crc16_clmul(const uint8_t* data,
+                     size_t         length,
+                     uint16_t       crc)
+{
+#ifdef PCJR_CRC_CLMUL
+  if ( length >= 64 && crc16_clmul_supported() )
+  {
+    return crc16_clmul_kernel(data, length, crc);
+  }
+#endif
+  return crc16_slice8(data, length, crc);
+}
+
+} // namespace pcjr
@@ -0,0 +1,510 @@
+/*
+ * This file is part of the PCjr/utility distribution (https://github.com/guldmuddypaws/utility).
+ * Copyright (c) 2022 Jason R Neuhaus
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, version 3.
+ *
+ * This program is distributed in the hope that it will be useful, but
+ * WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the GNU
+ * General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program. If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include "pcjr_file.h"
+
+#include <algorithm>
+#include <cstring>
+
+#ifdef _WIN32
+#include <fcntl.h>
+#include <io.h>
+#include <windows.h>
+#else
+#include <dirent.h>
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#endif
+
+namespace
+{
+
+#ifdef _WIN32
+const char path_separator = '\\';
+#else
+const char path_separator = '/';
+#endif
+
+// Match a name against a pattern with '*' (any run) and '?' (any one)
+bool wildcard_match(const char* pattern, const char* name)
+{
+  const char* star_pattern = 0;
+  const char* star_name    = 0;
+
+  while ( *name != '\0' )
+  {
+    if ( *pattern == '*' )
+    {
+      star_pattern = ++pattern;
+      star_name    = name;
+    }
+    else if ( *pattern == '?' || *pattern == *name )
+    {
+      ++pattern;
+      ++name;
+    }
+    else if ( star_pattern != 0 )
+    {
+      // Let the last '*' swallow one more character and try again
+      pattern = star_pattern;
+      name    = ++star_name;
+    }
+    else
+    {
+      return false;
+    }
+  }
+
+  while ( *pattern == '*' )
+  {
+    ++pattern;
+  }
+  return *pattern == '\0';
+}
+
+// Join a directory and a name, avoiding a doubled separator
+std::string join_path(const std::string& directory, const std::string& name)
+{
+  if ( directory.empty() )
+  {
+    return name;
+  }
+  const char last = directory[directory.size() - 1];
+  if ( last == '/' || last == path_separator )
+  {
+    return directory + name;
+  }
+  return directory + path_separator + name;
+}
+
+// True for a symbolic link (or junction), without following it
+bool is_link(const std::string& path)
+{
+#ifdef _WIN32
+  const DWORD attributes = GetFileAttributesA(path.c_str());
+  return attributes != INVALID_FILE_ATTRIBUTES &&
+    ( attributes & FILE_ATTRIBUTE_REPARSE_POINT );
+#else
+  struct stat link_status;
+  return lstat(path.c_str(), &link_status) == 0 &&
+    S_ISLNK(link_status.st_mode);
+#endif
+}
+
+// Call back for every entry in a directory (not "." or "..")
+template <typename Visitor>
+bool for_each_entry(const std::string& directory, Visitor visit)
+{
+#ifdef _WIN32
+  WIN32_FIND_DATAA find_data;
+  HANDLE find_handle = FindFirstFileA(join_path(directory, "*").c_str(),
+                                      &find_data);
+  if ( find_handle == INVALID_HANDLE_VALUE )
+  {
+    return false;
+  }
+  do
+  {
+    if ( strcmp(find_data.cFileName, ".") != 0 &&
+         strcmp(find_data.cFileName, "..") != 0 )
+    {
+      visit(std::string(find_data.cFileName));
+    }
+  }
+  while ( FindNextFileA(find_handle, &find_data) );
+  FindClose(find_handle);
+#else
+  DIR* directory_stream = opendir(directory.empty() ? "." :
+                                  directory.c_str());
+  if ( directory_stream == 0 )
+  {
+    return false;
+  }
+  while ( struct dirent* entry = readdir(directory_stream) )
+  {
+    if ( strcmp(entry->d_name, ".") != 0 &&
+         strcmp(entry->d_name, "..") != 0 )
+    {
+      visit(std::string(entry->d_name));
+    }
+  }
+  closedir(directory_stream);
+#endif
+  return true;
+}
+
+} // namespace
+
+namespace pcjr
+{
+
+mapped_file::mapped_file()
+  : data_(0),
+    size_(0)
+#ifdef _WIN32
+  , file_handle_(INVALID_HANDLE_VALUE),
+    mapping_handle_(0)
+#endif
+{
+}
+
+mapped_file::~mapped_file()
+{
+  close();
+}
+
+#ifdef _WIN32
+
+bool mapped_file::open(const char* filename)
+{
+  close();
+
+  file_handle_ = CreateFileA(filename,
+                             GENERIC_READ,
+                             FILE_SHARE_READ,
+                             0,
+                             OPEN_EXISTING,
+                             FILE_FLAG_SEQUENTIAL_SCAN,
+                             0);
+  if ( file_handle_ == INVALID_HANDLE_VALUE )
+  {
+    return false;
+  }
+
+  LARGE_INTEGER file_size;
+  if ( !GetFileSizeEx(file_handle_, &file_size) ||
+       static_cast<uint64_t>(file_size.QuadPart) > SIZE_MAX )
+  {
+    close();
+    return false;
+  }
+
+  size_ = static_cast<uint64_t>(file_size.QuadPart);
+  if ( size_ == 0 )
+  {
+    // Nothing to map, an empty file is still valid
+    return true;
+  }
+
+  mapping_handle_ = CreateFileMappingA(file_handle_, 0, PAGE_READONLY,
+                                       0, 0, 0);
+  if ( mapping_handle_ == 0 )
+  {
+    close();
+    return false;
+  }
+
+  data_ = static_cast<const uint8_t*>(MapViewOfFile(mapping_handle_,
+                                                    FILE_MAP_READ,
+                                                    0, 0, 0));
+  if ( data_ == 0 )
+  {
+    close();
+    return false;
+  }
+
+  return true;
+}
+
+void mapped_file::close()
+{
+  if ( data_ != 0 )
+  {
+    UnmapViewOfFile(data_);
+  }
+  if ( mapping_handle_ != 0 )
+  {
+    CloseHandle(mapping_handle_);
+  }
+  if ( file_handle_ != INVALID_HANDLE_VALUE )
+  {
+    CloseHandle(file_handle_);
+  }
+
+  data_           = 0;
+  size_           = 0;
+  mapping_handle_ = 0;
+  file_handle_    = INVALID_HANDLE_VALUE;
+}
+
+void set_stdin_binary()
+{
+  _setmode(_fileno(stdin), _O_BINARY);
+}
+
+#else // POSIX
+
+bool mapped_file::open(const char* filename)
+{
+  close();
+
+  const int file_descriptor = ::open(filename, O_RDONLY);
+  if ( file_descriptor < 0 )
+  {
+    return false;
+  }
+
+  // Only regular files can be mapped, pipes and devices have to be streamed
+  struct stat file_status;
+  if ( fstat(file_descriptor, &file_status) != 0 ||
+       !S_ISREG(file_status.st_mode) ||
+       static_cast<uint64_t>(file_status.st_size) > SIZE_MAX )
+  {
+    ::close(file_descriptor);
+    return false;
+  }
+
+  size_ = static_cast<uint64_t>(file_status.st_size);
+  if ( size_ == 0 )
+  {
+    // Nothing to map, an empty file is still valid
+    ::close(file_descriptor);
+    return true;
+  }
+
+  void* mapping = mmap(0, static_cast<size_t>(size_), PROT_READ, MAP_PRIVATE,
+                       file_descriptor, 0);
+
+  // The mapping keeps its own reference to the file
+  ::close(file_descriptor);
+
+  if ( mapping == MAP_FAILED )
+  {
+    size_ = 0;
+    return false;
+  }
+
+  // The CRC walks the file front to back, let the OS read ahead
+  madvise(mapping, static_cast<size_t>(size_), MADV_SEQUENTIAL);
+
+  data_ = static_cast<const uint8_t*>(mapping);
+  return true;
+}
+
+void mapped_file::close()
+{
+  if ( data_ != 0 )
+  {
+    munmap(const_cast<uint8_t*>(data_), static_cast<size_t>(size_));
+  }
+
+  data_ = 0;
+  size_ = 0;
+}
+
+void set_stdin_binary()
+{
+}
+
+#endif
+
+bool file_size(const std::string& filename,
+               uint64_t&          size)
+{
+#ifdef _WIN32
+  WIN32_FILE_ATTRIBUTE_DATA attributes;
+  if ( !GetFileAttributesExA(filename.c_str(), GetFileExInfoStandard,
+                             &attributes) ||
+       ( attributes.dwFileAttributes & FILE_ATTRIBUTE_DIRECTORY ) )
+  {
+    return false;
+  }
+  size = ( static_cast<uint64_t>(attributes.nFileSizeHigh) << 32 ) |
+    attributes.nFileSizeLow;
+  return true;
+#else
+  struct stat file_status;
+  if ( stat(filename.c_str(), &file_status) != 0 ||
+       !S_ISREG(file_status.st_mode) )
+  {
+    return false;
+  }
+  size = static_cast<uint64_t>(file_status.st_size);
+  return true;
+#endif
+}
+
+bool is_directory(const std::string& path)
+{
+#ifdef _WIN32
+  const DWORD attributes = GetFileAttributesA(path.c_str());
+  return attributes != INVALID_FILE_ATTRIBUTES &&
+    ( attributes & FILE_ATTRIBUTE_DIRECTORY );
+#else
+  struct stat file_status;
+  return stat(path.c_str(), &file_status) == 0 &&
+    S_ISDIR(file_status.st_mode);
+#endif
+}
+
+bool list_directory(const std::string&        directory,
+                     std::vector<std::string>& files)
+{
+  bool ok = true;
+  const size_t first = files.size();
+  const bool listed = for_each_entry(directory,
+    [&](const std::string& name)
+    {
+      const std::string path = join_path(directory, name);
+      uint64_t size;
+      if ( is_directory(path) )
+      {
+        // Links to directories are not followed, a link back up the tree
+        // (a/loop -> ..) would otherwise recurse forever
+        if ( !is_link(path) )
+        {
+          ok = list_directory(path, files) && ok;
+        }
+      }
+      else if ( file_size(path, size) )
+      {
+        files.push_back(path);
+      }
+    });
+  if ( !listed )
+  {
+    return false;
+  }
+  // Directory order is arbitrary, sort so manifests are repeatable
+  std::sort(files.begin() + first, files.end());
+  return ok;
+}
+
+bool expand_wildcards(const std::string&        pattern,
+                      std::vector<std::string>& files)
+{
+  const std::string::size_type split = pattern.find_last_of("/\\");
+  const std::string directory = ( split == std::string::npos ?
+                                  std::string() :
+                                  pattern.substr(0, split + 1) );
+  const std::string name_pattern = ( split == std::string::npos ?
+                                     pattern :
+                                     pattern.substr(split + 1) );
+
+  const size_t first = files.size();
+  const bool listed = for_each_entry(directory,
+    [&](const std::string& name)
+    {
+      const std::string path = join_path(directory, name);
+      uint64_t size;
+      if ( wildcard_match(name_pattern.c_str(), name.c_str()) &&
+           file_size(path, size) )
+      {
+        files.push_back(path);
+      }
+    });
+  if ( !listed )
+  {
+    return false;
+  }
+  std::sort(files.begin() + first, files.end());
+  return true;
+}
+
+namespace
+{
+
+bool seek_to(std::FILE* file, uint64_t offset)
+{
+#ifdef _WIN32
+  return _fseeki64(file, static_cast<__int64>(offset), SEEK_SET) == 0;
+#else
+  return fseeko(file, static_cast<off_t>(offset), SEEK_SET) == 0;
+#endif
+}
+
+} // namespace
+
+bool read_at(std::FILE* file,
+             uint64_t   offset,
+             void*      data,
+             size_t     length)
+{
+  return seek_to(file, offset) &&
+    std::fread(data, 1, length, file) == length;
+}
+
+bool write_at(std::FILE*  file,
+              uint64_t    offset,
+              const void* data,
+              size_t      length)
+{
+  return seek_to(file, offset) &&
+    std::fwrite(data, 1, length, file) == length;
+}
+
+bool crc16_stream(std::FILE*   file,
+                  uint64_t     skip,
+                  unsigned int ignore_tail,
+                  uint16_t&    crc,
+                  uint64_t&    stream_size,
+                  crc16_engine engine)
+{
+  // Room for one block plus the tail bytes held back from the last block
+  std::vector<uint8_t> buffer(stream_block_size + ignore_tail);
+
+  // Number of held back bytes at the start of the buffer
+  size_t pending = 0;
+  // Stream offset of buffer[0]
+  uint64_t position = 0;
+
+  stream_size = 0;
+
+  for (;;)
+  {
+    const size_t bytes_read = std::fread(&buffer[0] + pending, 1,
+                                         stream_block_size, file);
+    stream_size += bytes_read;
+
+    // Everything but the last ignore_tail bytes can be processed, they may
+    // turn out to be the end of the stream.
+    const size_t available = pending + bytes_read;
+    const size_t process   = ( available > ignore_tail ?
+                               available - ignore_tail : 0 );
+
+    size_t start = 0;
+    if ( position < skip )
+    {
+      const uint64_t to_skip = skip - position;
+      start = ( to_skip < process ? static_cast<size_t>(to_skip) : process );
+    }
+
+    crc = crc16(engine, &buffer[0] + start, process - start, crc);
+
+    position += process;
+    pending   = available - process;
+    std::memmove(&buffer[0], &buffer[0] + process, pending);
+
+    // fread only returns less than asked for at the end of the stream or on
+    // an error
+    if ( bytes_read < stream_block_size )
+    {
+      break;
+    }
+  }
+
+  if ( std::ferror(file) )
+  {
+    return false;
+  }
+
+  return stream_size >= skip + ignore_tail;
+}
+
+} // namespace pcjr
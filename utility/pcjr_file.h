@@ -0,0 +1,145 @@
+/*
+ * This file is part of the PCjr/utility distribution (https://github.com/guldmuddypaws/utility).
+ * Copyright (c) 2022 Jason R Neuhaus
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, version 3.
+ *
+ * This program is distributed in the hope that it will be useful, but
+ * WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the GNU
+ * General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program. If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#ifndef PCJR_FILE_H
+#define PCJR_FILE_H
+
+// Input helpers for the CRC utilities. Files are either memory mapped (no
+// copy, the OS pages the data in as the CRC walks it) or streamed in fixed
+// size blocks (stdin, pipes, or anything that cannot be mapped). All sizes
+// and offsets are 64 bit.
+
+#include <cstddef>
+#include <cstdint>
+#include <cstdio>
+#include <string>
+#include <vector>
+
+#include "pcjr_crc.h"
+
+namespace pcjr
+{
+
+// Size of each block read by the streaming functions.
+static const size_t stream_block_size = 1024 * 1024;
+
+/** Read only memory mapping of a whole file. */
+class mapped_file
+{
+public:
+  mapped_file();
+  ~mapped_file();
+
+  /** Map a file into memory, unmapping any file already mapped.
+      @param filename Name of the file to map
+      @return true on success. An empty file maps successfully with a size
+      of 0 and a null data pointer.
+  */
+  bool open(const char* filename);
+
+  /** Unmap the file. Safe to call if nothing is mapped. */
+  void close();
+
+  const uint8_t* data() const { return data_; }
+  uint64_t       size() const { return size_; }
+
+private:
+  // Not copyable, the mapping is owned by this object.
+  mapped_file(const mapped_file&);
+  mapped_file& operator=(const mapped_file&);
+
+  const uint8_t* data_;
+  uint64_t       size_;
+#ifdef _WIN32
+  void*          file_handle_;
+  void*          mapping_handle_;
+#endif
+};
+
+/** Compute the CRC of a stream, reading it in blocks of stream_block_size.
+    Works on stdin and pipes, the length does not need to be known up front.
+    @param file Stream to read from (opened in binary mode)
+    @param skip Number of bytes at the start of the stream left out of the
+    CRC (e.g. the 512 byte .jrc header)
+    @param ignore_tail Number of bytes at the end of the stream left out of
+    the CRC (e.g. the 2 CRC bytes). These are held back as the stream is read
+    since the end is only known once it is reached.
+    @param crc CRC to start from, updated with the result.
+    @param stream_size Total number of bytes read from the stream.
+    @param engine Engine used for the CRC.
+    @return true on success, false on a read error or if the stream is
+    shorter than skip + ignore_tail bytes.
+*/
+extern bool crc16_stream(std::FILE*   file,
+                         uint64_t     skip,
+                         unsigned int ignore_tail,
+                         uint16_t&    crc,
+                         uint64_t&    stream_size,
+                         crc16_engine engine = crc16_engine_auto);
+
+/** Get the size of a file without opening it.
+    @param filename Name of the file
+    @param size Set to the size of the file in bytes
+    @return true if the file exists and is a regular file.
+*/
+extern bool file_size(const std::string& filename,
+                      uint64_t&          size);
+
+/** @return true if the path names a directory. */
+extern bool is_directory(const std::string& path);
+
+/** List the regular files in a directory, recursing into subdirectories.
+    Links to directories are skipped so a link loop cannot recurse forever.
+    @param directory Directory to list
+    @param files Paths of the files found are appended here
+    @return false if the directory could not be read.
+*/
+extern bool list_directory(const std::string&        directory,
+                           std::vector<std::string>& files);
+
+/** Expand a path whose last component contains '*' or '?' wildcards into
+    the matching regular files (no recursion).
+    @param pattern Path with wildcards in the last component, e.g. a
+    directory followed by "*.jrc"
+    @param files Matching paths are appended here, sorted by name
+    @return false if the directory part could not be read.
+*/
+extern bool expand_wildcards(const std::string&        pattern,
+                             std::vector<std::string>& files);
+
+/** Read bytes from a given (64 bit) offset of a file.
+    @return true if all length bytes were read.
+*/
+extern bool read_at(std::FILE* file,
+                    uint64_t   offset,
+                    void*      data,
+                    size_t     length);
+
+/** Write bytes at a given (64 bit) offset of a file.
+    @return true if all length bytes were written.
+*/
+extern bool write_at(std::FILE*  file,
+                     uint64_t    offset,
+                     const void* data,
+                     size_t      length);
+
+/** Put stdin into binary mode (no-op outside of Windows). */
+extern void set_stdin_binary();
+
+} // namespace pcjr
+
+#endif // PCJR_FILE_H
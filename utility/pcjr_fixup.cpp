@@ -0,0 +1,442 @@
+/*
+ * This file is part of the PCjr/utility distribution (https://github.com/guldmuddypaws/utility).
+ * Copyright (c) 2022 Jason R Neuhaus
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, version 3.
+ *
+ * This program is distributed in the hope that it will be useful, but
+ * WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the GNU
+ * General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program. If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include "pcjr_fixup.h"
+
+#include <algorithm>
+#include <cstdint>
+#include <cstdio>
+#include <iomanip>
+
+#include "pcjr_cart.h"
+#include "pcjr_file.h"
+
+namespace
+{
+
+// Patched bytes are read this much at a time
+const size_t patch_buffer_size = 64 * 1024;
+
+// Closes a FILE* when it goes out of scope
+class file_closer
+{
+public:
+  explicit file_closer(std::FILE* file) : file_(file) {}
+  ~file_closer() { if ( file_ != 0 ) std::fclose(file_); }
+
+  // Close now, reporting any error flushing buffered writes
+  bool close()
+  {
+    const bool ok = ( std::fclose(file_) == 0 );
+    file_ = 0;
+    return ok;
+  }
+
+private:
+  file_closer(const file_closer&);
+  file_closer& operator=(const file_closer&);
+
+  std::FILE* file_;
+};
+
+bool range_less(const pcjr::byte_range& a, const pcjr::byte_range& b)
+{
+  return a.offset < b.offset;
+}
+
+// Clip ranges to [start, end), then sort and merge overlapping or touching
+// ranges so every byte is patched exactly once.
+std::vector<pcjr::byte_range> normalize_ranges(
+  const std::vector<pcjr::byte_range>& ranges,
+  uint64_t                             start,
+  uint64_t                             end)
+{
+  std::vector<pcjr::byte_range> clipped;
+  for ( size_t i = 0 ; i < ranges.size() ; ++i )
+  {
+    const uint64_t first = std::max(ranges[i].offset, start);
+    // Guard against offset + length wrapping around
+    const uint64_t last  = ( ranges[i].length > end - ranges[i].offset ?
+                             end :
+                             std::min(ranges[i].offset + ranges[i].length,
+                                      end) );
+    if ( ranges[i].offset < end && first < last )
+    {
+      pcjr::byte_range range = { first, last - first };
+      clipped.push_back(range);
+    }
+  }
+
+  std::sort(clipped.begin(), clipped.end(), range_less);
+
+  std::vector<pcjr::byte_range> merged;
+  for ( size_t i = 0 ; i < clipped.size() ; ++i )
+  {
+    if ( !merged.empty() &&
+         clipped[i].offset <= merged.back().offset + merged.back().length )
+    {
+      const uint64_t last = std::max(merged.back().offset +
+                                     merged.back().length,
+                                     clipped[i].offset + clipped[i].length);
+      merged.back().length = last - merged.back().offset;
+    }
+    else
+    {
+      merged.push_back(clipped[i]);
+    }
+  }
+  return merged;
+}
+
+// Print a byte or CRC as fixed width hex
+std::ostream& hex(std::ostream& log, unsigned int value, int width)
+{
+  return log << std::hex << std::setw(width) << std::setfill('0') << value
+             << std::dec;
+}
+
+} // namespace
+
+namespace pcjr
+{
+
+bool parse_number(const char*  text,
+                  const char*& end,
+                  uint64_t&    value)
+{
+  // Only a 0x or 0X prefix selects hex. A leading 0 is still decimal (not
+  // octal like strtoull() base 0) and signs or spaces are not accepted.
+  unsigned int base = 10;
+  if ( text[0] == '0' && ( text[1] == 'x' || text[1] == 'X' ) )
+  {
+    base  = 16;
+    text += 2;
+  }
+
+  value = 0;
+  end   = text;
+  for (;; ++end )
+  {
+    unsigned int digit;
+    if ( *end >= '0' && *end <= '9' )
+    {
+      digit = static_cast<unsigned int>( *end - '0' );
+    }
+    else if ( base == 16 && *end >= 'a' && *end <= 'f' )
+    {
+      digit = static_cast<unsigned int>( *end - 'a' + 10 );
+    }
+    else if ( base == 16 && *end >= 'A' && *end <= 'F' )
+    {
+      digit = static_cast<unsigned int>( *end - 'A' + 10 );
+    }
+    else
+    {
+      break;
+    }
+
+    if ( value > ( UINT64_MAX - digit ) / base )
+    {
+      return false;
+    }
+    value = value * base + digit;
+  }
+
+  return end != text;
+}
+
+bool parse_ranges(const char*              text,
+                  std::vector<byte_range>& ranges)
+{
+  const char* position = text;
+  for (;;)
+  {
+    const char* end;
+    byte_range range;
+    if ( !parse_number(position, end, range.offset) || *end != ':' )
+    {
+      return false;
+    }
+    position = end + 1;
+    if ( !parse_number(position, end, range.length) ||
+         ( *end != ',' && *end != '\0' ) )
+    {
+      return false;
+    }
+    ranges.push_back(range);
+    if ( *end == '\0' )
+    {
+      return true;
+    }
+    position = end + 1;
+  }
+}
+
+bool fixup_image(const char*                    filename,
+                 bool                           jrc_file,
+                 const char*                    previous,
+                 const std::vector<byte_range>& patches,
+                 crc16_engine                   engine,
+                 std::ostream&                  log)
+{
+  uint64_t size;
+  if ( !file_size(filename, size) )
+  {
+    log << "Unable to open file '" << filename << "'\n";
+    return false;
+  }
+
+  std::FILE* image_file = std::fopen(filename, "r+b");
+  if ( image_file == 0 )
+  {
+    log << "Unable to open file '" << filename << "' for writing\n";
+    return false;
+  }
+  file_closer image_closer(image_file);
+
+  // Enough of the start of the file to recognise a .jrc header
+  uint8_t header[jrc_header_size];
+  const size_t header_length = static_cast<size_t>(
+    std::min<uint64_t>(size, sizeof(header)) );
+  if ( !read_at(image_file, 0, header, header_length) )
+  {
+    log << "Unable to read file '" << filename << "'\n";
+    return false;
+  }
+  if ( !jrc_file )
+  {
+    jrc_file = is_jrc_image(filename, header, size);
+  }
+
+  const uint64_t start       = ( jrc_file ? jrc_header_size : 0 );
+  const uint64_t module_size = ( size > start ? size - start : 0 );
+  const uint64_t blocks      = module_size / module_block_size;
+  if ( module_size == 0 || module_size % module_block_size != 0 ||
+       blocks > max_module_blocks )
+  {
+    log << "Module in '" << filename << "' is " << module_size
+        << " bytes, it must be 1 to " << max_module_blocks << " blocks of "
+        << module_block_size << " bytes\n";
+    return false;
+  }
+
+  uint8_t module_header[module_length_offset + 1];
+  if ( !read_at(image_file, start, module_header, sizeof(module_header)) )
+  {
+    log << "Unable to read file '" << filename << "'\n";
+    return false;
+  }
+  if ( module_header[0] != module_signature[0] ||
+       module_header[1] != module_signature[1] )
+  {
+    log << "No 0x55 0xAA module signature in '" << filename << "'\n";
+    return false;
+  }
+
+  const uint8_t  old_length = module_header[module_length_offset];
+  const uint8_t  new_length = static_cast<uint8_t>(blocks);
+  const uint64_t length_offset = start + module_length_offset;
+
+  // The CRC covers everything in the module but the CRC itself
+  const uint64_t crc_offset = size - crc_size;
+  uint8_t crc_bytes[crc_size];
+  if ( !read_at(image_file, crc_offset, crc_bytes, crc_size) )
+  {
+    log << "Unable to read file '" << filename << "'\n";
+    return false;
+  }
+  const uint16_t old_crc = stored_crc(crc_bytes + crc_size);
+
+  uint16_t new_crc;
+  if ( previous == 0 )
+  {
+    // Full pass over the module with the new length byte in place
+    mapped_file image;
+    if ( !image.open(filename) || image.size() != size )
+    {
+      log << "Unable to read file '" << filename << "'\n";
+      return false;
+    }
+    const uint8_t* data = image.data() + start;
+    new_crc = crc16(engine, data, module_length_offset);
+    new_crc = crc16(engine, &new_length, 1, new_crc);
+    new_crc = crc16(engine, data + module_length_offset + 1,
+                    module_size - crc_size - module_length_offset - 1,
+                    new_crc);
+  }
+  else
+  {
+    // Start from the CRC of the unpatched image and apply only the
+    // differences, so just the patched ranges are read.
+    std::FILE* previous_file = std::fopen(previous, "rb");
+    uint64_t   previous_size;
+    if ( previous_file == 0 || !file_size(previous, previous_size) )
+    {
+      if ( previous_file != 0 )
+      {
+        std::fclose(previous_file);
+      }
+      log << "Unable to open file '" << previous << "'\n";
+      return false;
+    }
+    file_closer previous_closer(previous_file);
+
+    if ( previous_size != size )
+    {
+      log << "'" << previous << "' is " << previous_size << " bytes but '"
+          << filename << "' is " << size << " bytes\n";
+      return false;
+    }
+    if ( !read_at(previous_file, crc_offset, crc_bytes, crc_size) )
+    {
+      log << "Unable to read file '" << previous << "'\n";
+      return false;
+    }
+    new_crc = stored_crc(crc_bytes + crc_size);
+
+    // The length byte is always rewritten, so always part of the patch
+    std::vector<byte_range> ranges(patches);
+    const byte_range length_range = { length_offset, 1 };
+    ranges.push_back(length_range);
+    ranges = normalize_ranges(ranges, start, crc_offset);
+
+    std::vector<uint8_t> old_data(patch_buffer_size);
+    std::vector<uint8_t> new_data(patch_buffer_size);
+    uint64_t reread = 0;
+    for ( size_t r = 0 ; r < ranges.size() ; ++r )
+    {
+      for ( uint64_t done = 0 ; done < ranges[r].length ; )
+      {
+        const uint64_t offset = ranges[r].offset + done;
+        const size_t   piece  = static_cast<size_t>(
+          std::min<uint64_t>(ranges[r].length - done, patch_buffer_size) );
+
+        if ( !read_at(previous_file, offset, &old_data[0], piece) ||
+             !read_at(image_file, offset, &new_data[0], piece) )
+        {
+          log << "Unable to read patched bytes at offset " << offset << '\n';
+          return false;
+        }
+        if ( offset <= length_offset && length_offset < offset + piece )
+        {
+          new_data[static_cast<size_t>(length_offset - offset)] = new_length;
+        }
+
+        new_crc = crc16_patch(new_crc, module_size - crc_size,
+                              offset - start, &old_data[0], &new_data[0],
+                              piece);
+        done   += piece;
+        reread += piece;
+      }
+    }
+    log << "Incremental update from '" << previous << "', " << reread
+        << " patched bytes read\n";
+  }
+
+  crc_bytes[0] = static_cast<uint8_t>( new_crc >> 8 );
+  crc_bytes[1] = static_cast<uint8_t>( new_crc );
+  if ( !write_at(image_file, length_offset, &new_length, 1) ||
+       !write_at(image_file, crc_offset, crc_bytes, crc_size) ||
+       !image_closer.close() )
+  {
+    log << "Unable to write file '" << filename << "'\n";
+    return false;
+  }
+
+  log << "Length: ";
+  hex(log, old_length, 2) << " -> ";
+  hex(log, new_length, 2) << " (" << blocks << " blocks)\n";
+  log << "CRC: ";
+  hex(log, old_crc, 4) << " -> ";
+  hex(log, new_crc, 4) << '\n';
+  return true;
+}
+
+bool force_image(const char*   filename,
+                 uint64_t      skip,
+                 unsigned int  ignore_tail,
+                 uint64_t      offset,
+                 uint16_t      target,
+                 crc16_engine  engine,
+                 std::ostream& log)
+{
+  uint8_t  old_bytes[crc_size];
+  uint16_t crc_zeroed;
+  uint64_t length_after;
+  {
+    mapped_file image;
+    if ( !image.open(filename) )
+    {
+      log << "Unable to open file '" << filename << "'\n";
+      return false;
+    }
+
+    const uint64_t size = image.size();
+    if ( size < skip + ignore_tail || offset < skip ||
+         offset > size - ignore_tail ||
+         size - ignore_tail - offset < crc_size )
+    {
+      log << "Offset " << offset << " is not 2 bytes inside the " << size
+          << " byte CRC range of '" << filename << "' (" << skip
+          << " bytes skipped, " << ignore_tail << " ignored at the end)\n";
+      return false;
+    }
+
+    // One pass over the data, with the 2 bytes counted as zero
+    const uint8_t* data = image.data();
+    length_after = size - ignore_tail - offset - crc_size;
+    crc_zeroed = crc16(engine, data + skip, offset - skip);
+    crc_zeroed = crc16_shift(crc_zeroed, crc_size);
+    crc_zeroed = crc16(engine, data + offset + crc_size, length_after,
+                       crc_zeroed);
+    old_bytes[0] = data[offset];
+    old_bytes[1] = data[offset + 1];
+  }
+
+  uint8_t new_bytes[crc_size];
+  if ( !crc16_force(crc_zeroed, length_after, target, new_bytes) )
+  {
+    log << "No value at offset " << offset << " gives CRC ";
+    hex(log, target, 4) << '\n';
+    return false;
+  }
+
+  std::FILE* image_file = std::fopen(filename, "r+b");
+  if ( image_file == 0 )
+  {
+    log << "Unable to open file '" << filename << "' for writing\n";
+    return false;
+  }
+  file_closer image_closer(image_file);
+  if ( !write_at(image_file, offset, new_bytes, crc_size) ||
+       !image_closer.close() )
+  {
+    log << "Unable to write file '" << filename << "'\n";
+    return false;
+  }
+
+  log << "Offset " << offset << ": ";
+  hex(log, old_bytes[0], 2) << ' ';
+  hex(log, old_bytes[1], 2) << " -> ";
+  hex(log, new_bytes[0], 2) << ' ';
+  hex(log, new_bytes[1], 2) << '\n';
+  log << "CRC: ";
+  hex(log, target, 4) << '\n';
+  return true;
+}
+
+} // namespace pcjr
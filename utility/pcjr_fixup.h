@@ -0,0 +1,110 @@
+/*
+ * This file is part of the PCjr/utility distribution (https://github.com/guldmuddypaws/utility).
+ * Copyright (c) 2022 Jason R Neuhaus
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, version 3.
+ *
+ * This program is distributed in the hope that it will be useful, but
+ * WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the GNU
+ * General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program. If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#ifndef PCJR_FIXUP_H
+#define PCJR_FIXUP_H
+
+// In place fixup of cartridge images: fills in the module length byte after
+// 0x55 0xAA and the trailing 2 byte CRC that pcjr_cart_template.asm leaves
+// to be edited by hand. Works on raw (.car) and .jrc images. Images can also
+// have their CRC forced to a chosen value by rewriting any 2 bytes.
+
+#include <cstdint>
+#include <ostream>
+#include <vector>
+
+#include "pcjr_crc.h"
+
+namespace pcjr
+{
+
+// A run of bytes in a file
+struct byte_range
+{
+  uint64_t offset;
+  uint64_t length;
+};
+
+/** Parse a file offset or length, decimal or hex with a 0x prefix. A
+    leading 0 does not make it octal.
+    @param text Text to parse
+    @param end Set to the first character after the number
+    @param value Set to the number
+    @return false if text does not start with a number or it does not fit in
+    64 bits.
+*/
+extern bool parse_number(const char*  text,
+                         const char*& end,
+                         uint64_t&    value);
+
+/** Parse a list of byte ranges, "offset:length[,offset:length...]". Numbers
+    are decimal, or hex with a 0x prefix.
+    @param text Text to parse
+    @param ranges Parsed ranges are appended here
+    @return false if the text is not a valid list.
+*/
+extern bool parse_ranges(const char*              text,
+                         std::vector<byte_range>& ranges);
+
+/** Rewrite the module length byte and trailing CRC of an image in place.
+    @param filename Image to fix up. The module (after any .jrc header) must
+    be a whole number of 512 byte blocks and start with 0x55 0xAA.
+    @param jrc_file true to treat the image as .jrc, otherwise it is detected
+    from the extension/header.
+    @param previous Optional (0 if not used) name of a copy of the image
+    before it was patched, with a valid CRC. When given, only the patched
+    ranges of both files are read and the CRC stored in the previous image
+    is updated for them instead of rescanning the whole module.
+    @param patches File offsets of every byte that differs between previous
+    and filename (ignored without previous).
+    @param engine Engine used for a full rescan
+    @param log Stream progress and errors are written to
+    @return true if the image was updated.
+*/
+extern bool fixup_image(const char*                    filename,
+                        bool                           jrc_file,
+                        const char*                    previous,
+                        const std::vector<byte_range>& patches,
+                        crc16_engine                   engine,
+                        std::ostream&                  log);
+
+/** Overwrite 2 bytes of an image so its CRC becomes a chosen value, for
+    instance 0 so a module with a CRC field that cannot be moved checks out.
+    The file is read once and only the 2 bytes are written.
+    @param filename Image to change
+    @param skip Number of bytes at the start of the file left out of the CRC
+    (e.g. the 512 byte .jrc header)
+    @param ignore_tail Number of bytes at the end of the file left out of the
+    CRC
+    @param offset File offset of the 2 bytes to overwrite, they must be inside
+    the part of the file covered by the CRC
+    @param target CRC wanted
+    @param engine Engine used for the CRC
+    @param log Stream progress and errors are written to
+    @return true if the image was updated.
+*/
+extern bool force_image(const char*   filename,
+                        uint64_t      skip,
+                        unsigned int  ignore_tail,
+                        uint64_t      offset,
+                        uint16_t      target,
+                        crc16_engine  engine,
+                        std::ostream& log);
+
+} // namespace pcjr
+
+#endif // PCJR_FIXUP_H
@@ -0,0 +1,252 @@
+/*
+ * This file is part of the PCjr/utility distribution (https://github.com/guldmuddypaws/utility).
+ * Copyright (c) 2022 Jason R Neuhaus
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, version 3.
+ *
+ * This program is distributed in the hope that it will be useful, but
+ * WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the GNU
+ * General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program. If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include "pcjr_scan.h"
+
+#include <cstdio>
+#include <deque>
+#include <iostream>
+
+#include "pcjr_cart.h"
+#include "pcjr_file.h"
+#include "pcjr_thread_pool.h"
+
+namespace
+{
+
+// Modules are handed to the workers in groups of up to this many bytes or
+// modules, most modules are only a few KiB.
+const uint64_t group_bytes   = 1024 * 1024;
+const size_t   group_modules = 64;
+
+void verify_module(pcjr::rom_module&  module,
+                   const uint8_t*     data,
+                   pcjr::crc16_engine engine)
+{
+  const uint8_t* start = data + module.offset;
+  module.crc        = pcjr::crc16(engine, start,
+                                  static_cast<size_t>(module.size -
+                                                      pcjr::crc_size));
+  module.stored_crc = pcjr::stored_crc(start + module.size);
+  module.status     = ( module.crc == module.stored_crc ?
+                        pcjr::module_pass : pcjr::module_fail );
+}
+
+void submit_group(pcjr::thread_pool&              pool,
+                  std::vector<pcjr::rom_module*>& group,
+                  const uint8_t*                  data,
+                  pcjr::crc16_engine              engine)
+{
+  pool.submit([group, data, engine]()
+              {
+                for ( size_t g = 0 ; g < group.size() ; ++g )
+                {
+                  verify_module(*group[g], data, engine);
+                }
+              });
+  group.clear();
+}
+
+const char* status_name(pcjr::module_status status)
+{
+  switch ( status )
+  {
+  case pcjr::module_pass:
+    return "pass";
+  case pcjr::module_fail:
+    return "fail";
+  case pcjr::module_truncated:
+    return "truncated";
+  case pcjr::module_empty:
+  default:
+    return "empty";
+  }
+}
+
+std::string hex(uint64_t value, int width)
+{
+  char text[24];
+  std::snprintf(text, sizeof(text), "%0*llx", width,
+                static_cast<unsigned long long>(value));
+  return text;
+}
+
+void write_report(const std::vector<pcjr::rom_module>& modules,
+                  uint64_t                             base,
+                  pcjr::manifest_format                format,
+                  std::ostream&                        report)
+{
+  if ( format == pcjr::manifest_csv )
+  {
+    report << "offset,address,size,blocks,crc,stored_crc,result\n";
+  }
+  else
+  {
+    report << "[\n";
+  }
+
+  for ( size_t i = 0 ; i < modules.size() ; ++i )
+  {
+    const pcjr::rom_module& module = modules[i];
+    const bool has_crc = ( module.status == pcjr::module_pass ||
+                           module.status == pcjr::module_fail );
+
+    if ( format == pcjr::manifest_csv )
+    {
+      report << module.offset << ','
+             << hex(base + module.offset, 5) << ','
+             << module.size << ','
+             << module.size / pcjr::module_block_size << ','
+             << ( has_crc ? hex(module.crc, 4) : "" ) << ','
+             << ( has_crc ? hex(module.stored_crc, 4) : "" ) << ','
+             << status_name(module.status) << '\n';
+    }
+    else
+    {
+      report << "  {\"offset\": " << module.offset
+             << ", \"address\": \"" << hex(base + module.offset, 5) << '"'
+             << ", \"size\": " << module.size
+             << ", \"blocks\": " << module.size / pcjr::module_block_size;
+      if ( has_crc )
+      {
+        report << ", \"crc\": \"" << hex(module.crc, 4) << '"'
+               << ", \"stored_crc\": \"" << hex(module.stored_crc, 4) << '"';
+      }
+      report << ", \"result\": \"" << status_name(module.status) << '"'
+             << ( i + 1 < modules.size() ? "},\n" : "}\n" );
+    }
+  }
+
+  if ( format == pcjr::manifest_json )
+  {
+    report << "]\n";
+  }
+}
+
+} // namespace
+
+namespace pcjr
+{
+
+void scan_rom_modules(const uint8_t*           data,
+                      uint64_t                 size,
+                      unsigned int             threads,
+                      crc16_engine             engine,
+                      std::vector<rom_module>& modules)
+{
+  // Every signature found, in dump order. A deque so the workers can fill in
+  // entries while more are added.
+  std::deque<rom_module> candidates;
+
+  {
+    thread_pool pool(threads);
+
+    std::vector<rom_module*> group;
+    uint64_t                 group_size = 0;
+
+    for ( uint64_t offset = 0 ;
+          offset + module_length_offset < size ;
+          offset += rom_scan_step )
+    {
+      const uint8_t* start = data + offset;
+      if ( start[0] != module_signature[0] ||
+           start[1] != module_signature[1] )
+      {
+        continue;
+      }
+
+      rom_module module;
+      module.offset     = offset;
+      module.size       = static_cast<uint64_t>(start[module_length_offset]) *
+        module_block_size;
+      module.crc        = 0;
+      module.stored_crc = 0;
+      module.status     = ( module.size == 0 ? module_empty :
+                            module.size > size - offset ? module_truncated :
+                            module_fail );
+      candidates.push_back(module);
+
+      if ( module.status == module_fail )
+      {
+        group.push_back(&candidates.back());
+        group_size += module.size;
+        if ( group_size >= group_bytes || group.size() >= group_modules )
+        {
+          submit_group(pool, group, data, engine);
+          group_size = 0;
+        }
+      }
+    }
+
+    if ( !group.empty() )
+    {
+      submit_group(pool, group, data, engine);
+    }
+    pool.wait();
+  }
+
+  // Like the BIOS, carry on after the end of a module that verified, a
+  // signature inside it is just part of its code or data.
+  uint64_t next_offset = 0;
+  for ( size_t i = 0 ; i < candidates.size() ; ++i )
+  {
+    const rom_module& module = candidates[i];
+    if ( module.offset < next_offset )
+    {
+      continue;
+    }
+    modules.push_back(module);
+    if ( module.status == module_pass )
+    {
+      next_offset = ( module.offset + module.size + rom_scan_step - 1 ) /
+        rom_scan_step * rom_scan_step;
+    }
+  }
+}
+
+long run_scan(const char*          filename,
+              uint64_t             base,
+              const batch_options& options,
+              std::ostream&        report,
+              size_t&              modules_found)
+{
+  mapped_file dump;
+  if ( !dump.open(filename) )
+  {
+    std::cerr << "Error opening input file: '" << filename << "'\n";
+    return -1;
+  }
+
+  std::vector<rom_module> modules;
+  scan_rom_modules(dump.data(), dump.size(), options.threads,
+                   options.engine, modules);
+
+  write_report(modules, base, options.format, report);
+
+  long failures = 0;
+  for ( size_t i = 0 ; i < modules.size() ; ++i )
+  {
+    if ( modules[i].status != module_pass )
+    {
+      ++failures;
+    }
+  }
+  modules_found = modules.size();
+  return failures;
+}
+
+} // namespace pcjr
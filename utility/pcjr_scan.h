@@ -0,0 +1,88 @@
+/*
+ * This file is part of the PCjr/utility distribution (https://github.com/guldmuddypaws/utility).
+ * Copyright (c) 2022 Jason R Neuhaus
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, version 3.
+ *
+ * This program is distributed in the hope that it will be useful, but
+ * WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the GNU
+ * General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program. If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#ifndef PCJR_SCAN_H
+#define PCJR_SCAN_H
+
+// ROM module scan of a raw memory or EPROM dump, done the way the BIOS does
+// it: every 2 KiB boundary is checked for 0x55 0xAA, the byte after it gives
+// the module length in 512 byte blocks, and the module is verified against
+// the CRC in its last 2 bytes. A module that verifies is skipped over as a
+// whole, anything else moves on to the next boundary.
+
+#include <cstddef>
+#include <cstdint>
+#include <ostream>
+#include <vector>
+
+#include "pcjr_batch.h"
+#include "pcjr_crc.h"
+
+namespace pcjr
+{
+
+enum module_status
+{
+  module_pass,
+  module_fail,
+  module_truncated, // runs past the end of the dump
+  module_empty      // length byte is 0
+};
+
+struct rom_module
+{
+  uint64_t      offset;     // from the start of the dump
+  uint64_t      size;       // in bytes, from the length byte
+  uint16_t      crc;
+  uint16_t      stored_crc;
+  module_status status;
+};
+
+/** Find and verify every module in a dump. The dump is walked once on the
+    calling thread and each module found is verified on a thread pool while
+    the walk carries on.
+    @param data Contents of the dump
+    @param size Size of the dump in bytes
+    @param threads Number of worker threads, 0 = one per hardware thread
+    @param engine Engine used for the CRC
+    @param modules Modules found are appended here, in dump order
+*/
+extern void scan_rom_modules(const uint8_t*           data,
+                             uint64_t                 size,
+                             unsigned int             threads,
+                             crc16_engine             engine,
+                             std::vector<rom_module>& modules);
+
+/** Scan a dump file and write a report of the modules found.
+    @param filename Dump to scan, memory mapped
+    @param base Address of the first byte of the dump (e.g. 0xC0000),
+    added to the offsets in the report
+    @param options Report format, thread count and CRC engine
+    @param report Stream the report is written to
+    @param modules_found Set to the number of modules found
+    @return Number of modules that did not verify, or -1 if the dump could
+    not be read (reported on std::cerr).
+*/
+extern long run_scan(const char*          filename,
+                     uint64_t             base,
+                     const batch_options& options,
+                     std::ostream&        report,
+                     size_t&              modules_found);
+
+} // namespace pcjr
+
+#endif // PCJR_SCAN_H
@@ -0,0 +1,382 @@
+/*
+ * This file is part of the PCjr/utility distribution (https://github.com/guldmuddypaws/utility).
+ * Copyright (c) 2022 Jason R Neuhaus
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, version 3.
+ *
+ * This program is distributed in the hope that it will be useful, but
+ * WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the GNU
+ * General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program. If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include "pcjr_selftest.h"
+
+#include <algorithm>
+#include <cstdio>
+#include <iomanip>
+#include <random>
+#include <vector>
+
+#include "pcjr_batch.h"
+#include "pcjr_cart.h"
+#include "pcjr_crc.h"
+#include "pcjr_file.h"
+
+namespace
+{
+
+// Running totals and failure reporting
+struct checker
+{
+  std::ostream& log;
+  unsigned long checks;
+  unsigned long failures;
+
+  explicit checker(std::ostream& output)
+    : log(output),
+      checks(0),
+      failures(0)
+  {
+  }
+
+  void expect(uint16_t    expected,
+              uint16_t    actual,
+              const char* what,
+              uint64_t    offset,
+              uint64_t    length)
+  {
+    ++checks;
+    if ( expected != actual )
+    {
+      ++failures;
+      log << "FAIL " << what << ": offset " << std::dec << offset
+          << " length " << length << " expected " << std::hex
+          << std::setw(4) << std::setfill('0') << expected << " got "
+          << std::setw(4) << actual << std::dec << '\n';
+    }
+  }
+
+  void expect(bool passed, const char* what)
+  {
+    ++checks;
+    if ( !passed )
+    {
+      ++failures;
+      log << "FAIL " << what << '\n';
+    }
+  }
+};
+
+const pcjr::crc16_engine all_engines[] =
+{
+  pcjr::crc16_engine_table,
+  pcjr::crc16_engine_slice8,
+  pcjr::crc16_engine_clmul,
+  pcjr::crc16_engine_auto
+};
+
+// Offset into the test buffer: aligned, misaligned, or just after a .jrc
+// header
+uint64_t random_offset(std::mt19937& random)
+{
+  switch ( random() % 3 )
+  {
+  case 0:
+    return 0;
+  case 1:
+    return 1 + random() % 15;
+  default:
+    return pcjr::jrc_header_size;
+  }
+}
+
+// Every engine against the emulation
+void test_engines(checker& check, const std::vector<uint8_t>& data,
+                  std::mt19937& random)
+{
+  // Known answer for the CCITT polynomial with a 0xFFFF seed
+  const uint8_t digits[] = { '1', '2', '3', '4', '5', '6', '7', '8', '9' };
+  check.expect(0x29B1, pcjr::crc16_emulation(digits, sizeof(digits)),
+               "emulation known answer", 0, sizeof(digits));
+
+  // The quick check each engine ships with
+  for ( size_t e = 0 ;
+        e < sizeof(all_engines) / sizeof(all_engines[0]) ;
+        ++e )
+  {
+    check.expect(pcjr::crc16_verify(all_engines[e]),
+                 pcjr::crc16_engine_name(all_engines[e]));
+  }
+
+  for ( unsigned int i = 0 ; i < 2000 ; ++i )
+  {
+    // Mostly short blocks, where the engines switch between their paths,
+    // with the odd long one
+    const uint64_t offset = random_offset(random);
+    const uint64_t limit  = ( i % 50 == 0 ? 256 * 1024 : 1024 );
+    const uint64_t length = random() % limit;
+    const uint16_t seed   = ( i % 2 == 0 ? pcjr::crc16_seed :
+                              static_cast<uint16_t>(random()) );
+
+    const uint16_t expected = pcjr::crc16_emulation(&data[offset], length,
+                                                    seed);
+    for ( size_t e = 0 ;
+          e < sizeof(all_engines) / sizeof(all_engines[0]) ;
+          ++e )
+    {
+      check.expect(expected,
+                   pcjr::crc16(all_engines[e], &data[offset], length, seed),
+                   pcjr::crc16_engine_name(all_engines[e]), offset, length);
+    }
+  }
+}
+
+// Blocks split at arbitrary points, each piece processed on its own and the
+// results joined with crc16_combine(), and extending a CRC as data is
+// appended.
+void test_combine(checker& check, const std::vector<uint8_t>& data,
+                  std::mt19937& random)
+{
+  for ( unsigned int i = 0 ; i < 2000 ; ++i )
+  {
+    const uint64_t offset = random_offset(random);
+    const uint64_t length = random() % ( i % 20 == 0 ? 200000 : 3000 );
+    const uint16_t seed   = ( i % 4 != 0 ? pcjr::crc16_seed :
+                              static_cast<uint16_t>(random()) );
+
+    const uint16_t expected = pcjr::crc16_emulation(&data[offset], length,
+                                                    seed);
+
+    // 1 to 4 split points anywhere in the block, including 0 length pieces
+    std::vector<uint64_t> splits;
+    const unsigned int split_count = 1 + random() % 4;
+    for ( unsigned int s = 0 ; s < split_count ; ++s )
+    {
+      splits.push_back(length == 0 ? 0 : random() % ( length + 1 ));
+    }
+    splits.push_back(length);
+    std::sort(splits.begin(), splits.end());
+
+    uint64_t start = 0;
+    uint16_t combined = pcjr::crc16(&data[offset], splits[0], seed);
+    uint16_t appended = combined;
+    start = splits[0];
+    for ( size_t s = 1 ; s < splits.size() ; ++s )
+    {
+      const uint64_t piece = splits[s] - start;
+      combined = pcjr::crc16_combine(combined,
+                                     pcjr::crc16(&data[offset + start],
+                                                 piece, seed),
+                                     piece,
+                                     seed);
+      appended = pcjr::crc16(&data[offset + start], piece, appended);
+      start = splits[s];
+    }
+
+    check.expect(expected, combined, "combine", offset, length);
+    check.expect(expected, appended, "append", offset, length);
+  }
+
+  // Advancing over zero bytes is the same as processing them
+  const std::vector<uint8_t> zeros(70000, 0);
+  for ( unsigned int i = 0 ; i < 200 ; ++i )
+  {
+    const uint16_t crc    = static_cast<uint16_t>(random());
+    const uint64_t length = random() % zeros.size();
+    check.expect(pcjr::crc16_emulation(&zeros[0], length, crc),
+                 pcjr::crc16_shift(crc, length), "shift", 0, length);
+  }
+}
+
+// Updating the CRC of a block for a patched run of bytes
+void test_patch(checker& check, const std::vector<uint8_t>& data,
+                std::mt19937& random)
+{
+  std::vector<uint8_t> patched;
+  for ( unsigned int i = 0 ; i < 500 ; ++i )
+  {
+    const uint64_t offset = random_offset(random);
+    const uint64_t length = 1 + random() % ( i % 20 == 0 ? 100000 : 5000 );
+    const uint64_t patch_offset = random() % length;
+    const size_t   patch_length = static_cast<size_t>(
+      1 + random() % std::min<uint64_t>(length - patch_offset, 1000) );
+
+    patched.assign(data.begin() + offset, data.begin() + offset + length);
+    for ( size_t p = 0 ; p < patch_length ; ++p )
+    {
+      patched[patch_offset + p] = static_cast<uint8_t>(random());
+    }
+
+    check.expect(pcjr::crc16_emulation(&patched[0], length),
+                 pcjr::crc16_patch(pcjr::crc16(&data[offset], length),
+                                   length,
+                                   patch_offset,
+                                   &data[offset + patch_offset],
+                                   &patched[patch_offset],
+                                   patch_length),
+                 "patch", offset, length);
+  }
+}
+
+// Forcing a block to a chosen CRC by solving for 2 of its bytes, each forced
+// block checked with the emulation
+void test_force(checker& check, const std::vector<uint8_t>& data,
+                std::mt19937& random)
+{
+  std::vector<uint8_t> forced;
+  for ( unsigned int i = 0 ; i < 500 ; ++i )
+  {
+    const uint64_t offset = random_offset(random);
+    const uint64_t length = 2 + random() % ( i % 20 == 0 ? 100000 : 5000 );
+    // The 2 bytes anywhere, including the very start and the very end
+    const uint64_t position = ( i % 5 == 0 ? 0 :
+                                i % 5 == 1 ? length - 2 :
+                                random() % ( length - 1 ) );
+    const uint16_t target   = ( i % 4 == 0 ? 0 :
+                                static_cast<uint16_t>(random()) );
+
+    forced.assign(data.begin() + offset, data.begin() + offset + length);
+    forced[position]     = 0;
+    forced[position + 1] = 0;
+
+    uint8_t patch[2] = { 0, 0 };
+    if ( !pcjr::crc16_force(pcjr::crc16(&forced[0], length),
+                            length - position - 2, target, patch) )
+    {
+      // Counted as a failure by checking against an impossible value
+      check.expect(target, static_cast<uint16_t>(~target), "force solve",
+                   offset, length);
+      continue;
+    }
+    forced[position]     = patch[0];
+    forced[position + 1] = patch[1];
+    check.expect(target, pcjr::crc16_emulation(&forced[0], length),
+                 "force", offset, length);
+  }
+}
+
+// The multi-threaded CRC of a single block
+void test_parallel(checker& check, const std::vector<uint8_t>& data,
+                   std::mt19937& random)
+{
+  for ( unsigned int threads = 1 ; threads <= 4 ; ++threads )
+  {
+    const uint64_t offset = random_offset(random);
+    const uint64_t length = data.size() - offset - random() % 1000;
+    check.expect(pcjr::crc16_emulation(&data[offset], length),
+                 pcjr::crc16_parallel(&data[offset], length, threads),
+                 "parallel", offset, length);
+  }
+}
+
+// The window crc.cpp checks in a .jrc image run with /jrc /it: the module
+// after the 512 byte header without the trailing CRC, through the mapped,
+// threaded and streamed paths, resuming from an /append split point
+void test_window(checker& check, const std::vector<uint8_t>& data,
+                 std::mt19937& random)
+{
+  const uint64_t     skip = pcjr::jrc_header_size;
+  const unsigned int tail = pcjr::crc_size;
+
+  for ( unsigned int i = 0 ; i < 40 ; ++i )
+  {
+    // Now and then big enough for crc16_parallel() to really split it,
+    // always with a random /append split point (i % 4 == 3 below)
+    const uint64_t module = ( i % 8 == 3 ?
+                              3 * 1024 * 1024 + random() % ( 1024 * 1024 ) :
+                              random() % 100000 );
+    const uint64_t size   = skip + module + tail;
+    const uint8_t* image  = &data[0];
+
+    const uint16_t expected = pcjr::crc16_emulation(image + skip, module);
+
+    // The earlier run (/append) covered the start of the module, possibly
+    // none or all of it, as the window of a file that ended there
+    const uint64_t covered = ( i % 4 == 0 ? 0 :
+                               i % 4 == 1 ? module :
+                               random() % ( module + 1 ) );
+    uint16_t covered_crc = pcjr::crc16_seed;
+    check.expect(pcjr::crc16_window(image, skip + covered, skip, 0,
+                                    false, 0, pcjr::crc16_engine_auto,
+                                    covered_crc),
+                 "window append");
+
+    uint16_t mapped = covered_crc;
+    check.expect(pcjr::crc16_window(image, size, skip + covered, tail,
+                                    false, 0, pcjr::crc16_engine_auto,
+                                    mapped),
+                 "window mapped");
+    check.expect(expected, mapped, "window mapped", covered, module);
+
+    uint16_t threaded = covered_crc;
+    check.expect(pcjr::crc16_window(image, size, skip + covered, tail,
+                                    true, 1 + random() % 4,
+                                    pcjr::crc16_engine_auto, threaded),
+                 "window threaded");
+    check.expect(expected, threaded, "window threaded", covered, module);
+
+    // Streamed from a temporary copy of the image
+    uint16_t   streamed    = covered_crc;
+    uint64_t   stream_size = 0;
+    std::FILE* stream      = std::tmpfile();
+    const bool stream_ok   = ( stream != 0 &&
+                               std::fwrite(image, 1,
+                                           static_cast<size_t>(size),
+                                           stream) == size &&
+                               std::fseek(stream, 0, SEEK_SET) == 0 &&
+                               pcjr::crc16_stream(stream, skip + covered,
+                                                  tail, streamed,
+                                                  stream_size) &&
+                               stream_size == size );
+    if ( stream != 0 )
+    {
+      std::fclose(stream);
+    }
+    check.expect(stream_ok, "window streamed");
+    check.expect(expected, streamed, "window streamed", covered, module);
+  }
+
+  // Too small for the window is an error, not a wrapped length
+  uint16_t crc = pcjr::crc16_seed;
+  check.expect(!pcjr::crc16_window(&data[0], skip + 1, skip, tail, false, 0,
+                                   pcjr::crc16_engine_auto, crc),
+               "window too small");
+}
+
+} // namespace
+
+namespace pcjr
+{
+
+bool crc16_self_test(std::ostream& log,
+                     uint32_t      seed)
+{
+  std::mt19937 random(seed);
+
+  // Big enough that crc16_parallel() splits it into several chunks
+  std::vector<uint8_t> data(5 * 1024 * 1024 + 777);
+  for ( size_t i = 0 ; i < data.size() ; ++i )
+  {
+    data[i] = static_cast<uint8_t>(random());
+  }
+
+  checker check(log);
+  test_engines(check, data, random);
+  test_combine(check, data, random);
+  test_patch(check, data, random);
+  test_force(check, data, random);
+  test_parallel(check, data, random);
+  test_window(check, data, random);
+
+  log << "Self test: " << check.checks << " checks, " << check.failures
+      << " failed\n";
+  return check.failures == 0;
+}
+
+} // namespace pcjr
@@ -0,0 +1,41 @@
+/*
+ * This file is part of the PCjr/utility distribution (https://github.com/guldmuddypaws/utility).
+ * Copyright (c) 2022 Jason R Neuhaus
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, version 3.
+ *
+ * This program is distributed in the hope that it will be useful, but
+ * WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the GNU
+ * General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program. If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#ifndef PCJR_SELFTEST_H
+#define PCJR_SELFTEST_H
+
+// Built in cross checks of the CRC library. Everything is compared against
+// crc16_emulation(), the step by step replay of the BIOS assembly, on
+// pseudo random data, lengths, offsets and split points.
+
+#include <cstdint>
+#include <ostream>
+
+namespace pcjr
+{
+
+/** Run every self test.
+    @param log Stream each failure (and a summary) is written to
+    @param seed Seed for the pseudo random data, so failures can be repeated
+    @return true if every check passed.
+*/
+extern bool crc16_self_test(std::ostream& log,
+                            uint32_t      seed = 1);
+
+} // namespace pcjr
+
+#endif // PCJR_SELFTEST_H
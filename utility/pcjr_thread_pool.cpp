@@ -0,0 +1,159 @@
+/*
+ * This file is part of the PCjr/utility distribution (https://github.com/guldmuddypaws/utility).
+ * Copyright (c) 2022 Jason R Neuhaus
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, version 3.
+ *
+ * This program is distributed in the hope that it will be useful, but
+ * WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the GNU
+ * General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program. If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include "pcjr_thread_pool.h"
+
+namespace pcjr
+{
+
+thread_pool::thread_pool(unsigned int thread_count)
+  : queued_(0),
+    pending_(0),
+    stop_(false),
+    next_queue_(0)
+{
+  if ( thread_count == 0 )
+  {
+    thread_count = std::thread::hardware_concurrency();
+  }
+  if ( thread_count == 0 )
+  {
+    // hardware_concurrency() is allowed to not know
+    thread_count = 1;
+  }
+
+  for ( unsigned int i = 0 ; i < thread_count ; ++i )
+  {
+    queues_.push_back(std::unique_ptr<worker_queue>(new worker_queue));
+  }
+  for ( unsigned int i = 0 ; i < thread_count ; ++i )
+  {
+    threads_.push_back(std::thread(&thread_pool::run, this, i));
+  }
+}
+
+thread_pool::~thread_pool()
+{
+  wait();
+
+  {
+    std::lock_guard<std::mutex> lock(state_mutex_);
+    stop_ = true;
+  }
+  work_available_.notify_all();
+
+  for ( size_t i = 0 ; i < threads_.size() ; ++i )
+  {
+    threads_[i].join();
+  }
+}
+
+void thread_pool::submit(task work)
+{
+  const unsigned int index = next_queue_++ % queues_.size();
+
+  {
+    // Count the task in the same critical section it is queued in, so a
+    // worker can never take it before it has been counted
+    std::lock_guard<std::mutex> state_lock(state_mutex_);
+    std::lock_guard<std::mutex> queue_lock(queues_[index]->mutex);
+    queues_[index]->tasks.push_back(std::move(work));
+    ++queued_;
+    ++pending_;
+  }
+  work_available_.notify_one();
+}
+
+void thread_pool::wait()
+{
+  std::unique_lock<std::mutex> lock(state_mutex_);
+  while ( pending_ != 0 )
+  {
+    all_done_.wait(lock);
+  }
+}
+
+bool thread_pool::take(unsigned int index, task& work)
+{
+  // Newest task from our own queue first, it is most likely to be in cache
+  {
+    worker_queue& own = *queues_[index];
+    std::lock_guard<std::mutex> lock(own.mutex);
+    if ( !own.tasks.empty() )
+    {
+      work = std::move(own.tasks.back());
+      own.tasks.pop_back();
+      return true;
+    }
+  }
+
+  // Then steal the oldest task from the other workers
+  for ( size_t offset = 1 ; offset < queues_.size() ; ++offset )
+  {
+    worker_queue& victim = *queues_[( index + offset ) % queues_.size()];
+    std::lock_guard<std::mutex> lock(victim.mutex);
+    if ( !victim.tasks.empty() )
+    {
+      work = std::move(victim.tasks.front());
+      victim.tasks.pop_front();
+      return true;
+    }
+  }
+
+  return false;
+}
+
+void thread_pool::run(unsigned int index)
+{
+  for (;;)
+  {
+    {
+      std::unique_lock<std::mutex> lock(state_mutex_);
+      while ( !stop_ && queued_ == 0 )
+      {
+        work_available_.wait(lock);
+      }
+      if ( queued_ == 0 )
+      {
+        // Stopping and nothing left to do
+        return;
+      }
+
+      // Claim one of the queued tasks before leaving the lock. Every claim
+      // matches a task still sitting in some queue, so take() below always
+      // finds one and no worker spins waiting for another to catch up.
+      --queued_;
+    }
+
+    task work;
+    take(index, work);
+
+    work();
+
+    bool finished = false;
+    {
+      std::lock_guard<std::mutex> lock(state_mutex_);
+      finished = ( --pending_ == 0 );
+    }
+    if ( finished )
+    {
+      all_done_.notify_all();
+    }
+  }
+}
+
+} // namespace pcjr
@@ -0,0 +1,90 @@
+/*
+ * This file is part of the PCjr/utility distribution (https://github.com/guldmuddypaws/utility).
+ * Copyright (c) 2022 Jason R Neuhaus
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, version 3.
+ *
+ * This program is distributed in the hope that it will be useful, but
+ * WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the GNU
+ * General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program. If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#ifndef PCJR_THREAD_POOL_H
+#define PCJR_THREAD_POOL_H
+
+// Small work stealing thread pool. Each worker owns a queue. Submitted tasks
+// are spread over the queues, a worker takes from the back of its own queue
+// and, once that is empty, steals from the front of the others so uneven
+// tasks (one huge file amongst many small ones) still keep every core busy.
+
+#include <atomic>
+#include <condition_variable>
+#include <cstddef>
+#include <deque>
+#include <functional>
+#include <memory>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+namespace pcjr
+{
+
+class thread_pool
+{
+public:
+  typedef std::function<void()> task;
+
+  /** Start the worker threads.
+      @param thread_count Number of workers, 0 uses one per hardware thread.
+  */
+  explicit thread_pool(unsigned int thread_count = 0);
+
+  /** Wait for all tasks to finish and stop the workers. */
+  ~thread_pool();
+
+  /** Queue a task to run on one of the workers. Tasks must not throw. */
+  void submit(task work);
+
+  /** Block until every submitted task has finished. */
+  void wait();
+
+  /** @return Number of worker threads. */
+  unsigned int size() const { return static_cast<unsigned int>(threads_.size()); }
+
+private:
+  thread_pool(const thread_pool&);
+  thread_pool& operator=(const thread_pool&);
+
+  struct worker_queue
+  {
+    std::mutex       mutex;
+    std::deque<task> tasks;
+  };
+
+  void run(unsigned int index);
+  bool take(unsigned int index, task& work);
+
+  std::vector<std::unique_ptr<worker_queue> > queues_;
+  std::vector<std::thread>                    threads_;
+
+  // Protects the counters below and is used with the condition variables
+  std::mutex              state_mutex_;
+  std::condition_variable work_available_;
+  std::condition_variable all_done_;
+  size_t                  queued_;  // Tasks waiting in a queue
+  size_t                  pending_; // Tasks submitted and not yet finished
+  bool                    stop_;
+
+  std::atomic<unsigned int> next_queue_;
+};
+
+} // namespace pcjr
+
+#endif // PCJR_THREAD_POOL_H